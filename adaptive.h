@@ -0,0 +1,425 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "bitpack.h"
+
+/** Skip index for the adaptive stream: byte offset of every `stride`-th
+  * group, the number of blocks and of values in them. Built by
+  * AdaptiveEncoder while the stream is written.
+  */
+class BlockIndex {
+    std::vector<u64> offsets_;
+    int stride_;
+    u64 ngroups_;
+    u64 nblocks_;
+    u64 nvalues_;
+public:
+    explicit BlockIndex(int stride = 8)
+        : stride_(stride)
+        , ngroups_(0)
+        , nblocks_(0)
+        , nvalues_(0)
+    {
+        if (stride < 1) {
+            throw std::invalid_argument("Invalid index stride");
+        }
+    }
+
+    void add_group(u64 offset) {
+        if (ngroups_ % stride_ == 0) {
+            offsets_.push_back(offset);
+        }
+        ngroups_++;
+    }
+
+    //! Block with `nvalues` values, less than 16 for a padded last block
+    void add_block(int nvalues) {
+        if (16*nblocks_ != nvalues_) {
+            throw std::logic_error("Partial block should be the last one");
+        }
+        nblocks_++;
+        nvalues_ += nvalues;
+    }
+
+    int stride() const {
+        return stride_;
+    }
+
+    u64 nblocks() const {
+        return nblocks_;
+    }
+
+    //! Number of values, padding of the last block excluded
+    u64 nvalues() const {
+        return nvalues_;
+    }
+
+    //! Offset of the closest indexed group at or before `group`
+    u64 offset(u64 group) const {
+        return offsets_[group / stride_];
+    }
+};
+
+/** Self-describing stream, every 16-value block is packed with its own
+  * width. Blocks are grouped by GROUP_SIZE, a group starts with the widths
+  * of its blocks (one byte each) followed by the packed blocks. Last group
+  * can be incomplete, unused width slots are zero.
+  */
+class AdaptiveEncoder {
+    MemoryStream &stream_;
+    const KernelTable& kernels_;
+    BlockIndex* index_;
+    //! Width slots of the current group and position in it
+    u8* write_widths_;
+    int write_index_;
+    const u8* read_widths_;
+    int read_index_;
+public:
+    enum {
+        GROUP_SIZE = 8,
+    };
+
+    AdaptiveEncoder(MemoryStream& stream,
+                    const KernelTable& kernels = best_kernels(),
+                    BlockIndex* index = nullptr)
+        : stream_(stream)
+        , kernels_(kernels)
+        , index_(index)
+        , write_widths_(nullptr)
+        , write_index_(GROUP_SIZE)
+        , read_widths_(nullptr)
+        , read_index_(GROUP_SIZE)
+    {
+    }
+
+    //! Worst case size of `nblocks` blocks in bytes
+    static size_t max_size(size_t nblocks) {
+        return (nblocks + GROUP_SIZE - 1) / GROUP_SIZE * GROUP_SIZE + 128*nblocks;
+    }
+
+    /** Pack 16 values, returns false if the stream is full. A partial
+      * last block is padded by the caller, `nvalues` is the number of
+      * values in it for the index.
+      */
+    bool pack(const u64* input, int nvalues = 16) {
+        if (write_index_ == GROUP_SIZE) {
+            const size_t offset = stream_.size();
+            u8* widths = stream_.allocate(GROUP_SIZE);
+            if (!widths) {
+                return false;
+            }
+            if (index_) {
+                index_->add_group(offset);
+            }
+            std::memset(widths, 0, GROUP_SIZE);
+            write_widths_ = widths;
+            write_index_ = 0;
+        }
+        const int n = get_block_width(input);
+        if (!kernels_.pack[n](stream_, input)) {
+            return false;
+        }
+        write_widths_[write_index_++] = static_cast<u8>(n);
+        if (index_) {
+            index_->add_block(nvalues);
+        }
+        return true;
+    }
+
+    //! Unpack 16 values, output is overwritten
+    void unpack(u64* output) {
+        if (read_index_ == GROUP_SIZE) {
+            read_widths_ = stream_.consume(GROUP_SIZE);
+            read_index_ = 0;
+        }
+        const int n = read_widths_[read_index_++];
+        if (n > 64) {
+            throw std::out_of_range("Invalid bit width");
+        }
+        if (!kernels_.unpack[n](stream_, output)) {
+            throw std::out_of_range("End-Of-Stream");
+        }
+    }
+
+    //! Start reading from the beginning of the stream
+    void rewind() {
+        stream_.reset();
+        read_index_ = GROUP_SIZE;
+    }
+};
+
+/** Walk `count` values of an adaptive stream in raw bytes,
+  * `visit(n, input, nvalues)` is called for every block with its width,
+  * payload and number of values (16 except for a partial last block).
+  * Returns number of bytes read.
+  */
+template<class Visitor>
+size_t adaptive_visit(const u8* data, size_t size, u64 count, Visitor& visit) {
+    size_t offset = 0;
+    const u8* widths = data;
+    for (u64 block = 0; 16*block < count; block++) {
+        if (block % AdaptiveEncoder::GROUP_SIZE == 0) {
+            if (offset + AdaptiveEncoder::GROUP_SIZE > size) {
+                throw std::out_of_range("Corrupted stream");
+            }
+            widths = data + offset;
+            offset += AdaptiveEncoder::GROUP_SIZE;
+        }
+        const int n = widths[block % AdaptiveEncoder::GROUP_SIZE];
+        if (n > 64 || offset + 2*n > size) {
+            throw std::out_of_range("Corrupted stream");
+        }
+        visit(n, data + offset, static_cast<int>(std::min<u64>(16, count - 16*block)));
+        offset += 2*n;
+    }
+    return offset;
+}
+
+struct DecodeVisitor {
+    const KernelTable& kernels;
+    u64* output;
+
+    void operator () (int n, const u8* input, int nvalues) {
+        if (nvalues == 16) {
+            kernels.read[n](input, output);
+        } else {
+            u64 values[16];
+            kernels.read[n](input, values);
+            std::copy(values, values + nvalues, output);
+        }
+        output += nvalues;
+    }
+};
+
+//! Decode `count` values of an adaptive stream from raw bytes, returns number of bytes read
+inline size_t adaptive_decode(const u8* data, size_t size, u64 count, u64* output,
+                              const KernelTable& kernels = best_kernels()) {
+    DecodeVisitor visit = { kernels, output };
+    return adaptive_visit(data, size, count, visit);
+}
+
+/** Random access to the adaptive stream through the block index.
+  * Position of a block is found from the closest indexed group by
+  * summing block sizes from the width runs, at most `stride` groups.
+  */
+class AdaptiveReader {
+    const u8* data_;
+    size_t size_;
+    const BlockIndex& index_;
+    const KernelTable& kernels_;
+
+    //! Width run of the group at `offset`
+    const u8* _widths(size_t offset) const {
+        if (offset + AdaptiveEncoder::GROUP_SIZE > size_) {
+            throw std::out_of_range("Corrupted stream");
+        }
+        return data_ + offset;
+    }
+
+    //! Offset of the block payload, sets the width run of its group
+    size_t _locate(u64 block, const u8** widths) const {
+        const u64 group = block / AdaptiveEncoder::GROUP_SIZE;
+        size_t offset = index_.offset(group);
+        for (u64 g = group - group % index_.stride(); g < group; g++) {
+            const u8* run = _widths(offset);
+            size_t bytes = AdaptiveEncoder::GROUP_SIZE;
+            for (int i = 0; i < AdaptiveEncoder::GROUP_SIZE; i++) {
+                bytes += 2*run[i];
+            }
+            offset += bytes;
+        }
+        *widths = _widths(offset);
+        offset += AdaptiveEncoder::GROUP_SIZE;
+        for (u64 i = 0; i < block % AdaptiveEncoder::GROUP_SIZE; i++) {
+            offset += 2*(*widths)[i];
+        }
+        return offset;
+    }
+
+    //! Decode the block of width `n` at `offset`
+    void _decode(size_t offset, int n, u64* output) const {
+        if (n > 64 || offset + 2*n > size_) {
+            throw std::out_of_range("Corrupted stream");
+        }
+        kernels_.read[n](data_ + offset, output);
+    }
+public:
+    AdaptiveReader(const u8* data, size_t size, const BlockIndex& index,
+                   const KernelTable& kernels = best_kernels())
+        : data_(data)
+        , size_(size)
+        , index_(index)
+        , kernels_(kernels)
+    {
+    }
+
+    u64 size() const {
+        return index_.nvalues();
+    }
+
+    //! Value at position `i`
+    u64 get(u64 i) const {
+        if (i >= size()) {
+            throw std::out_of_range("Index out of range");
+        }
+        const u8* widths;
+        const size_t offset = _locate(i / 16, &widths);
+        u64 block[16];
+        _decode(offset, widths[(i / 16) % AdaptiveEncoder::GROUP_SIZE], block);
+        return block[i % 16];
+    }
+
+    //! Decode values [first, last) into `output`, blocks after the first one are read sequentially
+    void decode_range(u64 first, u64 last, u64* output) const {
+        if (first > last || last > size()) {
+            throw std::out_of_range("Index out of range");
+        }
+        if (first == last) {
+            return;
+        }
+        u64 block = first / 16;
+        const u8* widths;
+        size_t offset = _locate(block, &widths);
+        while (first < last) {
+            const int n = widths[block % AdaptiveEncoder::GROUP_SIZE];
+            u64 values[16];
+            _decode(offset, n, values);
+            const u64 begin = first % 16;
+            const u64 end = std::min<u64>(16, begin + (last - first));
+            output = std::copy(values + begin, values + end, output);
+            first += end - begin;
+            offset += 2*n;
+            block++;
+            if (block % AdaptiveEncoder::GROUP_SIZE == 0 && first < last) {
+                widths = _widths(offset);
+                offset += AdaptiveEncoder::GROUP_SIZE;
+            }
+        }
+    }
+};
+
+/** Forward cursor over `count` values of an adaptive stream in raw bytes.
+  * Holds one decoded block, `skip` moves over whole blocks by their width
+  * without decoding them, so a consumer that stops early never decodes
+  * the rest of the stream.
+  */
+class AdaptiveCursor {
+    const u8* data_;
+    size_t size_;
+    const KernelTable& kernels_;
+    //! Values left
+    u64 remaining_;
+    //! Offset and index of the next block that wasn't read yet
+    size_t offset_;
+    u64 block_;
+    const u8* widths_;
+    u64 buffer_[16];
+    //! Position inside `buffer_`, 16 if the buffer is empty
+    int pos_;
+    //! Values to drop from the start of the next block
+    int skip_;
+
+    //! Width and payload of the next block, moves past it
+    const u8* _next_block(int* n) {
+        if (block_ % AdaptiveEncoder::GROUP_SIZE == 0) {
+            if (offset_ + AdaptiveEncoder::GROUP_SIZE > size_) {
+                throw std::out_of_range("Corrupted stream");
+            }
+            widths_ = data_ + offset_;
+            offset_ += AdaptiveEncoder::GROUP_SIZE;
+        }
+        *n = widths_[block_ % AdaptiveEncoder::GROUP_SIZE];
+        if (*n > 64 || offset_ + 2*(*n) > size_) {
+            throw std::out_of_range("Corrupted stream");
+        }
+        const u8* input = data_ + offset_;
+        offset_ += 2*(*n);
+        block_++;
+        return input;
+    }
+
+    void _fill() {
+        int n;
+        const u8* input = _next_block(&n);
+        kernels_.read[n](input, buffer_);
+        pos_ = skip_;
+        skip_ = 0;
+    }
+public:
+    AdaptiveCursor(const u8* data, size_t size, u64 count,
+                   const KernelTable& kernels = best_kernels())
+        : data_(data)
+        , size_(size)
+        , kernels_(kernels)
+        , remaining_(count)
+        , offset_(0)
+        , block_(0)
+        , widths_(data)
+        , pos_(16)
+        , skip_(0)
+    {
+    }
+
+    //! Number of values left
+    u64 remaining() const {
+        return remaining_;
+    }
+
+    //! Next value, throws at the end of the stream
+    u64 next() {
+        if (remaining_ == 0) {
+            throw std::out_of_range("End-Of-Stream");
+        }
+        if (pos_ == 16) {
+            _fill();
+        }
+        remaining_--;
+        return buffer_[pos_++];
+    }
+
+    //! Decode up to `n` next values into `output`, returns number of values decoded
+    size_t next_batch(u64* output, size_t n) {
+        n = static_cast<size_t>(std::min<u64>(n, remaining_));
+        remaining_ -= n;
+        size_t done = 0;
+        while (done < n) {
+            if (pos_ == 16 && skip_ == 0 && n - done >= 16) {
+                // whole block goes straight to the output
+                int width;
+                const u8* input = _next_block(&width);
+                kernels_.read[width](input, output + done);
+                done += 16;
+                continue;
+            }
+            if (pos_ == 16) {
+                _fill();
+            }
+            const size_t k = std::min<size_t>(16 - pos_, n - done);
+            std::copy(buffer_ + pos_, buffer_ + pos_ + k, output + done);
+            pos_ += static_cast<int>(k);
+            done += k;
+        }
+        return n;
+    }
+
+    //! Move `n` values forward (at most to the end), returns number of values skipped
+    u64 skip(u64 n) {
+        n = std::min(n, remaining_);
+        remaining_ -= n;
+        const u64 buffered = 16 - pos_;
+        if (n <= buffered) {
+            pos_ += static_cast<int>(n);
+            return n;
+        }
+        u64 left = n - buffered + skip_;
+        pos_ = 16;
+        for (; left >= 16; left -= 16) {
+            int width;
+            _next_block(&width);
+        }
+        skip_ = static_cast<int>(left);
+        return n;
+    }
+};
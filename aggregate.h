@@ -0,0 +1,169 @@
+#pragma once
+#include <algorithm>
+
+#include "adaptive.h"
+
+/** Aggregates computed on the adaptive stream without materializing
+  * the values. Every block is decoded by the fused kernel straight into
+  * the accumulators, block widths are used to skip work: width-0 blocks
+  * are never decoded and min/max are not tracked for blocks that can't
+  * change them.
+  */
+namespace aggregate {
+
+struct Sum {
+    u64 sum;
+
+    void operator () (int, u64 value) {
+        sum += value;
+    }
+};
+
+struct SumMinMax {
+    u64 sum;
+    u64 min;
+    u64 max;
+
+    void operator () (int, u64 value) {
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+};
+
+//! Fixed-width buckets starting at `lo`, values out of range are not counted
+struct Histogram {
+    u64* counts;
+    u64 lo;
+    u64 bucket;
+    u64 nbuckets;
+
+    void operator () (int, u64 value) {
+        const u64 ix = (value - lo) / bucket;
+        if (value >= lo && ix < nbuckets) {
+            counts[ix]++;
+        }
+    }
+};
+
+template<class Op>
+struct Table {
+    typedef void (*Fn)(const u8* input, Op& op);
+
+    Fn fn[65];
+};
+
+template<class Op, int N>
+struct Kernel {
+    static void run(const u8* input, Op& op) {
+        BlockKernel<N>::decode(input, op);
+    }
+};
+
+template<class Op, int N>
+struct Fill {
+    static void run(Table<Op>& table) {
+        table.fn[N] = &Kernel<Op, N>::run;
+        Fill<Op, N - 1>::run(table);
+    }
+};
+
+template<class Op>
+struct Fill<Op, -1> {
+    static void run(Table<Op>&) {
+    }
+};
+
+template<class Op>
+Table<Op> make_table() {
+    Table<Op> table;
+    Fill<Op, 64>::run(table);
+    return table;
+}
+
+//! Fused decode kernels feeding `Op`, widths 0-64
+template<class Op>
+const Table<Op>& table() {
+    static const Table<Op> instance = make_table<Op>();
+    return instance;
+}
+
+struct TotalsVisitor {
+    const KernelTable& kernels;
+    SumMinMax acc;
+
+    void operator () (int n, const u8* input, int nvalues) {
+        if (nvalues < 16) {
+            u64 values[16];
+            kernels.read[n](input, values);
+            for (int i = 0; i < nvalues; i++) {
+                acc(i, values[i]);
+            }
+        } else if (n == 0) {
+            acc.min = 0;
+        } else if (acc.min == 0 && acc.max >= ~0ull >> (64 - n)) {
+            Sum sum = { acc.sum };
+            table<Sum>().fn[n](input, sum);
+            acc.sum = sum.sum;
+        } else {
+            table<SumMinMax>().fn[n](input, acc);
+        }
+    }
+};
+
+struct HistogramVisitor {
+    const KernelTable& kernels;
+    Histogram acc;
+
+    void operator () (int n, const u8* input, int nvalues) {
+        if (nvalues < 16) {
+            u64 values[16];
+            kernels.read[n](input, values);
+            for (int i = 0; i < nvalues; i++) {
+                acc(i, values[i]);
+            }
+        } else if (n == 0) {
+            if (acc.lo == 0 && acc.nbuckets > 0) {
+                acc.counts[0] += 16;
+            }
+        } else {
+            table<Histogram>().fn[n](input, acc);
+        }
+    }
+};
+
+}  // namespace aggregate
+
+struct Totals {
+    u64 count;
+    u64 sum;
+    u64 min;
+    u64 max;
+};
+
+//! Count, sum (modulo 2^64), min and max of `count` values of the adaptive stream
+inline Totals aggregate_totals(const u8* data, size_t size, u64 count,
+                               const KernelTable& kernels = best_kernels()) {
+    aggregate::TotalsVisitor visit = { kernels, { 0, ~0ull, 0 } };
+    adaptive_visit(data, size, count, visit);
+    const Totals totals = {
+        count,
+        visit.acc.sum,
+        count ? visit.acc.min : 0,
+        visit.acc.max,
+    };
+    return totals;
+}
+
+/** Add `count` values of the adaptive stream to `nbuckets` buckets of
+  * `bucket` width starting at `lo`.
+  */
+inline void aggregate_histogram(const u8* data, size_t size, u64 count,
+                                u64 lo, u64 bucket, u64 nbuckets, u64* counts,
+                                const KernelTable& kernels = best_kernels()) {
+    if (bucket == 0) {
+        throw std::invalid_argument("Invalid bucket width");
+    }
+    aggregate::HistogramVisitor visit = { kernels, { counts, lo, bucket, nbuckets } };
+    adaptive_visit(data, size, count, visit);
+}
@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "bitpack.h"
+
+/** Block codec for doubles in the spirit of ALP (adaptive lossless
+  * floating point). Values that are decimals with few digits are scaled
+  * by `10^e` and rounded to integers, the integers are stored as a frame
+  * of reference and packed with the width kernels. Values that don't
+  * come back bit-exact are exceptions and stored raw. Block layout:
+  *
+  *   u8 exponent, RAW if the block is stored as 16 raw doubles, then
+  *   u8 width, u8 number of exceptions, i64 base, packed residuals,
+  *   exception positions as 4-bit nibbles and their raw bits
+  *
+  * Exponent of the previous block is kept while it stays exact, the
+  * closest exponents are searched when it doesn't and every RETRY_BLOCKS
+  * blocks. Blocks that don't fit any exponent are stored raw, the search
+  * is tried again only every RETRY_BLOCKS blocks after that.
+  */
+namespace alp {
+
+enum {
+    MAX_EXPONENT = 18,
+    RAW = 0xFF,
+    //! Width, number of exceptions and base after the exponent
+    HEADER_SIZE = 10,
+    RETRY_BLOCKS = 32,
+};
+
+//! 2^52 + 2^51, adding it to an integer below 2^51 in magnitude gives the integer in the low mantissa bits
+static const double MAGIC = 6755399441055744.0;
+//! 2^51, scaled values at or above it in magnitude are exceptions
+static const double LIMIT = 2251799813685248.0;
+
+inline double power10(int e) {
+    static const double table[MAX_EXPONENT + 1] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+        1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+    };
+    return table[e];
+}
+
+/** Integer `n` (|n| < 2^51) back to the double, same arithmetic in
+  * encoder and decoder. Division by the exact power of ten is correctly
+  * rounded, so every decimal with `e` digits after the point comes back
+  * exactly as parsed, multiplication by the inexact inverse doesn't.
+  */
+inline double decode(u64 n, double scale) {
+    u64 bits;
+    std::memcpy(&bits, &MAGIC, sizeof(bits));
+    bits += n;
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return (value - MAGIC) / scale;
+}
+
+inline bool same_bits(double a, double b) {
+    u64 x, y;
+    std::memcpy(&x, &a, sizeof(x));
+    std::memcpy(&y, &b, sizeof(y));
+    return x == y;
+}
+
+//! Block scaled to integers at exponent `e`, integers of exceptions are unused
+struct Encoding {
+    int exponent;
+    i64 ints[16];
+    u16 exceptions;
+    int nexceptions;
+    i64 base;
+    int width;
+
+    void run(const double* input, int e) {
+        const double scale = power10(e);
+        exponent = e;
+        u32 mask = 0;
+        i64 lo = std::numeric_limits<i64>::max();
+        i64 hi = std::numeric_limits<i64>::min();
+        for (int i = 0; i < 16; i++) {
+            const double scaled = input[i] * scale;
+            // also false for NaN
+            const bool fits = scaled > -LIMIT && scaled < LIMIT;
+            const double rounded = fits ? (scaled + MAGIC) - MAGIC : 0;
+            ints[i] = static_cast<i64>(rounded);
+            // same as `decode(ints[i], scale)` for integers that fit
+            const bool exact = fits && same_bits(rounded / scale, input[i]);
+            mask |= static_cast<u32>(!exact) << i;
+            lo = exact ? std::min(lo, ints[i]) : lo;
+            hi = exact ? std::max(hi, ints[i]) : hi;
+        }
+        exceptions = static_cast<u16>(mask);
+        nexceptions = __builtin_popcount(mask);
+        base = nexceptions == 16 ? 0 : lo;
+        width = nexceptions == 16 ? 0 : get_bit_width(static_cast<u64>(hi - lo));
+    }
+
+    //! Encoded size of the block in bytes
+    size_t cost() const {
+        return 1 + HEADER_SIZE + 2*width + (nexceptions + 1)/2 + 8*nexceptions;
+    }
+};
+
+}  // namespace alp
+
+class FloatEncoder {
+    MemoryStream &stream_;
+    const KernelTable& kernels_;
+    //! Exponent of the previous block, -1 if it was stored raw
+    int exponent_;
+    u64 blocks_;
+
+    //! Best encoding of the block into `best`, returns false if raw is smaller
+    bool _choose(const double* input, alp::Encoding* best) {
+        const bool retry = blocks_++ % alp::RETRY_BLOCKS == 0;
+        if (exponent_ < 0 && !retry) {
+            return false;
+        }
+        const int start = std::max(exponent_, 0);
+        best->run(input, start);
+        if (best->nexceptions == 0 && !retry) {
+            return true;
+        }
+        size_t best_cost = 1 + 128;
+        int best_exponent = -1;
+        if (best->cost() <= best_cost) {
+            best_cost = best->cost();
+            best_exponent = start;
+        }
+        // smaller exponents while the block stays exact, larger ones until it is
+        const int step = best->nexceptions == 0 ? -1 : 1;
+        alp::Encoding encoding;
+        for (int e = start + step; e >= 0 && e <= alp::MAX_EXPONENT; e += step) {
+            encoding.run(input, e);
+            if (step < 0 && encoding.nexceptions != 0) {
+                break;
+            }
+            if (encoding.cost() <= best_cost) {
+                *best = encoding;
+                best_cost = encoding.cost();
+                best_exponent = e;
+            }
+            if (step > 0 && encoding.nexceptions == 0) {
+                break;
+            }
+        }
+        exponent_ = best_exponent;
+        return best_exponent >= 0;
+    }
+public:
+    FloatEncoder(MemoryStream& stream, const KernelTable& kernels = best_kernels())
+        : stream_(stream)
+        , kernels_(kernels)
+        , exponent_(0)
+        , blocks_(0)
+    {
+    }
+
+    //! Pack 16 values, returns false if the stream is full
+    bool pack(const double* input) {
+        alp::Encoding encoding;
+        if (!_choose(input, &encoding)) {
+            u8* header = stream_.allocate(1);
+            if (!header) {
+                return false;
+            }
+            header[0] = alp::RAW;
+            u64 bits[16];
+            std::memcpy(bits, input, sizeof(bits));
+            return kernels_.pack[64](stream_, bits);
+        }
+        u64 residuals[16];
+        u8 positions[8] = {};
+        u64 raw[16];
+        int count = 0;
+        for (int i = 0; i < 16; i++) {
+            if (encoding.exceptions >> i & 1) {
+                positions[count / 2] |= static_cast<u8>(i << 4*(count % 2));
+                std::memcpy(&raw[count++], &input[i], sizeof(u64));
+                residuals[i] = 0;
+            } else {
+                residuals[i] = static_cast<u64>(encoding.ints[i] - encoding.base);
+            }
+        }
+        u8* header = stream_.allocate(1 + alp::HEADER_SIZE);
+        if (!header) {
+            return false;
+        }
+        header[0] = static_cast<u8>(encoding.exponent);
+        header[1] = static_cast<u8>(encoding.width);
+        header[2] = static_cast<u8>(count);
+        std::memcpy(header + 3, &encoding.base, sizeof(encoding.base));
+        if (!kernels_.pack[encoding.width](stream_, residuals)) {
+            return false;
+        }
+        if (count) {
+            u8* out = stream_.allocate((count + 1)/2 + 8*count);
+            if (!out) {
+                return false;
+            }
+            std::memcpy(out, positions, (count + 1)/2);
+            std::memcpy(out + (count + 1)/2, raw, 8*count);
+        }
+        return true;
+    }
+
+    //! Unpack 16 values, output is overwritten
+    void unpack(double* output) {
+        const int e = *stream_.consume(1);
+        if (e == alp::RAW) {
+            u64 bits[16];
+            if (!kernels_.unpack[64](stream_, bits)) {
+                throw std::out_of_range("End-Of-Stream");
+            }
+            std::memcpy(output, bits, sizeof(bits));
+            return;
+        }
+        const u8* header = stream_.consume(alp::HEADER_SIZE);
+        const int n = header[0];
+        const int count = header[1];
+        if (e > alp::MAX_EXPONENT || n > 64 || count > 16) {
+            throw std::out_of_range("Invalid block header");
+        }
+        u64 base;
+        std::memcpy(&base, header + 2, sizeof(base));
+        u64 residuals[16];
+        if (!kernels_.unpack[n](stream_, residuals)) {
+            throw std::out_of_range("End-Of-Stream");
+        }
+        const double scale = alp::power10(e);
+        for (int i = 0; i < 16; i++) {
+            output[i] = alp::decode(residuals[i] + base, scale);
+        }
+        if (count) {
+            const u8* positions = stream_.consume((count + 1)/2);
+            const u8* raw = stream_.consume(8*count);
+            for (int i = 0; i < count; i++) {
+                std::memcpy(&output[(positions[i / 2] >> 4*(i % 2)) & 0xF], raw + 8*i, sizeof(double));
+            }
+        }
+    }
+};
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "bitpack.h"
+#include "vertical.h"
+#include "workload.h"
+
+#include "timing.h"
+
+struct PackRun {
+    MemoryStream& stream;
+    const KernelTable& kernels;
+    const std::vector<u64>& input;
+    int n;
+
+    void operator () () {
+        stream.reset();
+        for (size_t i = 0; i < input.size(); i += 16) {
+            kernels.pack[n](stream, input.data() + i);
+        }
+    }
+};
+
+struct UnpackRun {
+    MemoryStream& stream;
+    const KernelTable& kernels;
+    std::vector<u64>& output;
+    int n;
+
+    void operator () () {
+        stream.reset();
+        for (size_t i = 0; i < output.size(); i += 16) {
+            kernels.unpack[n](stream, output.data() + i);
+        }
+    }
+};
+
+//! Vertical kernels work on blocks of 32*LANES values
+template<int LANES>
+struct VerticalPackRun {
+    const vertical::Kernels<LANES>& kernels;
+    const std::vector<u64>& input;
+    std::vector<u8>& output;
+    int n;
+
+    void operator () () {
+        const size_t block = 32*LANES;
+        for (size_t i = 0; i < input.size(); i += block) {
+            kernels.pack[n](input.data() + i, output.data() + i/block*4*LANES*n);
+        }
+    }
+};
+
+template<int LANES>
+struct VerticalUnpackRun {
+    const vertical::Kernels<LANES>& kernels;
+    const std::vector<u8>& input;
+    std::vector<u64>& output;
+    int n;
+
+    void operator () () {
+        const size_t block = 32*LANES;
+        for (size_t i = 0; i < output.size(); i += block) {
+            kernels.unpack[n](input.data() + i/block*4*LANES*n, output.data() + i);
+        }
+    }
+};
+
+template<int LANES>
+void bench_vertical(const vertical::Kernels<LANES>& kernels, const std::vector<u64>& input,
+                    std::vector<u64>& output, int n)
+{
+    std::vector<u8> packed(8*input.size());
+    VerticalPackRun<LANES> pack = { kernels, input, packed, n };
+    VerticalUnpackRun<LANES> unpack = { kernels, packed, output, n };
+    const double pack_ns = bench::measure(pack, input.size());
+    const double unpack_ns = bench::measure(unpack, input.size());
+    std::cout << n << ",vertical" << LANES << "-" << kernels.name << "," << pack_ns << "," << unpack_ns << std::endl;
+}
+
+/** Compares every kernel table available on the host with the scalar
+  * kernels, vertical kernels included, prints pack/unpack time in
+  * ns/value for widths 0-64.
+  */
+int main()
+{
+    const CpuFeatures& cpu = cpu_features();
+    std::vector<const KernelTable*> tables;
+    tables.push_back(&kernel_table<ScalarKernels>());
+    if (cpu.bmi2) {
+        tables.push_back(&kernel_table<Bmi2Kernels<ScalarKernels> >());
+    }
+    if (cpu.sse41) {
+        tables.push_back(&kernel_table<Sse41Kernels>());
+    }
+    if (cpu.sse41 && cpu.bmi2) {
+        tables.push_back(&kernel_table<Bmi2Kernels<Sse41Kernels> >());
+    }
+    if (cpu.avx2) {
+        tables.push_back(&kernel_table<Avx2Kernels>());
+    }
+    if (cpu.avx2 && cpu.bmi2) {
+        tables.push_back(&kernel_table<Bmi2Kernels<Avx2Kernels> >());
+    }
+    if (cpu.avx512f) {
+        tables.push_back(&kernel_table<Avx512Kernels>());
+    }
+    if (cpu.avx512f && cpu.bmi2) {
+        tables.push_back(&kernel_table<Bmi2Kernels<Avx512Kernels> >());
+    }
+    tables.push_back(&best_kernels());
+
+    const size_t nvalues = 16*4096;
+    std::vector<u64> input(nvalues), output(nvalues);
+    MemoryStream stream(8*nvalues);
+    std::cout << "width,kernels,pack_ns,unpack_ns" << std::endl;
+    for (int n = 0; n <= 64; n++) {
+        workload::Uniform gen(n == 64 ? ~0ull : (1ull << n) - 1, n);
+        for (size_t i = 0; i < nvalues; i++) {
+            input[i] = gen.generate();
+        }
+        for (size_t t = 0; t < tables.size(); t++) {
+            const KernelTable& kernels = *tables[t];
+            PackRun pack = { stream, kernels, input, n };
+            UnpackRun unpack = { stream, kernels, output, n };
+            const double pack_ns = bench::measure(pack, nvalues);
+            const double unpack_ns = bench::measure(unpack, nvalues);
+            std::cout << n << "," << (t + 1 == tables.size() ? "best" : kernels.names[n]) << ","
+                      << pack_ns << "," << unpack_ns << std::endl;
+        }
+        bench_vertical<4>(vertical::scalar_kernels<4>(), input, output, n);
+        bench_vertical<8>(vertical::scalar_kernels<8>(), input, output, n);
+        if (cpu.avx2) {
+            bench_vertical<4>(vertical::avx2_kernels<4>(), input, output, n);
+            bench_vertical<8>(vertical::avx2_kernels<8>(), input, output, n);
+        }
+        if (cpu.avx512f) {
+            bench_vertical<8>(vertical::avx512_kernels(), input, output, n);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "bitpack.h"
+#include "workload.h"
+#include "scan.h"
+
+#include "timing.h"
+
+struct ScanRun {
+    MemoryStream& stream;
+    const scan::ScanTable& table;
+    std::vector<u8>& bitmap;
+    int n;
+    u64 lo;
+    u64 hi;
+
+    void operator () () {
+        stream.reset();
+        Scanner scanner(stream, table);
+        scanner.scan_range(n, bitmap.size() / 2, lo, hi, bitmap.data());
+    }
+};
+
+//! Unpack every block, compare the values and set the bitmap
+struct DecodeFilterRun {
+    MemoryStream& stream;
+    std::vector<u8>& bitmap;
+    int n;
+    u64 lo;
+    u64 hi;
+
+    void operator () () {
+        stream.reset();
+        Encoder encoder(stream);
+        for (size_t b = 0; b < bitmap.size() / 2; b++) {
+            u64 values[16];
+            encoder.unpack(values, n);
+            u32 bits = 0;
+            for (int i = 0; i < 16; i++) {
+                bits |= static_cast<u32>(lo <= values[i] && values[i] <= hi) << i;
+            }
+            bitmap[2*b] = static_cast<u8>(bits);
+            bitmap[2*b + 1] = static_cast<u8>(bits >> 8);
+        }
+    }
+};
+
+/** Range scan on packed blocks compared with decode-then-filter,
+  * ns/value for widths 0-64, range selects about half of the values.
+  */
+int main()
+{
+    const CpuFeatures& cpu = cpu_features();
+    std::vector<const scan::ScanTable*> tables;
+    tables.push_back(&scan::scalar_table());
+    if (cpu.avx512bw && cpu.avx512vl && cpu.bmi2) {
+        tables.push_back(&scan::avx512_table());
+    }
+    const size_t nvalues = 16*4096;
+    std::vector<u8> bitmap(nvalues / 8);
+    MemoryStream stream(8*nvalues);
+    std::cout << "width,decode_filter_ns";
+    for (size_t t = 0; t < tables.size(); t++) {
+        std::cout << "," << tables[t]->name << "_ns";
+    }
+    std::cout << std::endl;
+    for (int n = 0; n <= 64; n++) {
+        const u64 mask = n == 64 ? ~0ull : (1ull << n) - 1;
+        stream.reset();
+        Encoder encoder(stream);
+        workload::Uniform gen(mask, n);
+        for (size_t i = 0; i < nvalues; i += 16) {
+            u64 input[16];
+            for (int j = 0; j < 16; j++) {
+                input[j] = gen.generate();
+            }
+            encoder.pack(input, n);
+        }
+        const u64 lo = mask / 4, hi = mask / 4 * 3;
+        DecodeFilterRun baseline = { stream, bitmap, n, lo, hi };
+        std::cout << n << "," << bench::measure(baseline, nvalues);
+        for (size_t t = 0; t < tables.size(); t++) {
+            ScanRun run = { stream, *tables[t], bitmap, n, lo, hi };
+            std::cout << "," << bench::measure(run, nvalues);
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
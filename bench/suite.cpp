@@ -0,0 +1,361 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "adaptive.h"
+#include "bitpack.h"
+#include "delta.h"
+#include "for.h"
+#include "parallel.h"
+#include "workload.h"
+
+#include "timing.h"
+
+/** Benchmark suite: pack and unpack at every width 0-64, the block
+  * codecs on every workload distribution and the chunked encoder at
+  * every power of two threads, with working sets sized to L1, L2, L3
+  * and DRAM. Reports ns/value, values/s and encoded bytes/value,
+  * optionally as JSON (same layout as Google Benchmark).
+  *
+  * Options: --json=<file> --min-time=<seconds> --set=<L1|L2|L3|DRAM>
+  *          --width=<n> (only this width, no codecs)
+  *          --distribution=<name> (only this distribution, no widths)
+  *          --dram=<MB> (DRAM working set, twice the last level cache by default)
+  *          --threads=<n> (most threads of the chunked sweep, all cores by default)
+  */
+
+struct Options {
+    std::string json;
+    double min_time;
+    int width;
+    std::string set;
+    std::string distribution;
+    size_t dram;
+    int threads;
+
+    Options()
+        : min_time(0.05)
+        , width(-1)
+        , dram(0)
+        , threads(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+    {
+    }
+};
+
+struct WorkingSet {
+    const char* name;
+    //! Size of the value array in bytes
+    size_t bytes;
+};
+
+struct Result {
+    std::string name;
+    std::string op;
+    std::string set;
+    int width;
+    std::string distribution;
+    size_t nvalues;
+    u64 iterations;
+    double ns_per_value;
+    double bytes_per_value;
+};
+
+static size_t cache_size(int name, size_t fallback) {
+    const long size = sysconf(name);
+    return size > 0 ? static_cast<size_t>(size) : fallback;
+}
+
+//! Half of every cache level, DRAM set is well above the last level
+static std::vector<WorkingSet> working_sets(const Options& options) {
+    const size_t l1 = cache_size(_SC_LEVEL1_DCACHE_SIZE, 32 << 10);
+    const size_t l2 = cache_size(_SC_LEVEL2_CACHE_SIZE, 1 << 20);
+    const size_t l3 = cache_size(_SC_LEVEL3_CACHE_SIZE, 32 << 20);
+    std::vector<WorkingSet> sets;
+    const WorkingSet all[] = {
+        {"L1", l1 / 2},
+        {"L2", l2 / 2},
+        {"L3", l3 / 2},
+        {"DRAM", options.dram ? options.dram : std::max<size_t>(2*l3, 64 << 20)},
+    };
+    for (size_t i = 0; i < sizeof(all)/sizeof(all[0]); i++) {
+        sets.push_back(all[i]);
+    }
+    return sets;
+}
+
+struct PackBench {
+    MemoryStream& stream;
+    const std::vector<u64>& input;
+    int n;
+
+    void operator () () {
+        stream.reset();
+        Encoder encoder(stream);
+        for (size_t i = 0; i < input.size(); i += 16) {
+            encoder.pack(input.data() + i, n);
+        }
+    }
+};
+
+struct UnpackBench {
+    MemoryStream& stream;
+    std::vector<u64>& output;
+    int n;
+
+    void operator () () {
+        stream.reset();
+        Encoder encoder(stream);
+        for (size_t i = 0; i < output.size(); i += 16) {
+            encoder.unpack(output.data() + i, n);
+        }
+    }
+};
+
+//! Block codec (adaptive, FOR, PFOR, delta) packing 16 values at a time
+template<class Codec>
+struct CodecPackBench {
+    MemoryStream& stream;
+    const std::vector<u64>& input;
+
+    void operator () () {
+        stream.reset();
+        Codec codec(stream);
+        for (size_t i = 0; i < input.size(); i += 16) {
+            codec.pack(input.data() + i);
+        }
+    }
+};
+
+template<class Codec>
+struct CodecUnpackBench {
+    MemoryStream& stream;
+    std::vector<u64>& output;
+
+    void operator () () {
+        stream.reset();
+        Codec codec(stream);
+        for (size_t i = 0; i < output.size(); i += 16) {
+            codec.unpack(output.data() + i);
+        }
+    }
+};
+
+struct ChunkedPackBench {
+    MemoryStream& stream;
+    ThreadPool& pool;
+    const std::vector<u64>& input;
+
+    void operator () () {
+        stream.reset();
+        ChunkedEncoder encoder(stream, pool);
+        encoder.pack(input.data(), input.size());
+    }
+};
+
+struct ChunkedUnpackBench {
+    MemoryStream& stream;
+    ThreadPool& pool;
+    std::vector<u64>& output;
+
+    void operator () () {
+        stream.reset();
+        ChunkedEncoder encoder(stream, pool);
+        encoder.unpack(output);
+    }
+};
+
+static void print_result(const Result& r) {
+    std::cout.width(36);
+    std::cout << std::left << r.name << std::right;
+    std::cout.width(11);
+    std::cout << r.ns_per_value;
+    std::cout.width(12);
+    std::cout << 1e3 / r.ns_per_value;
+    std::cout.width(13);
+    std::cout << r.bytes_per_value << std::endl;
+}
+
+//! Pack and unpack `input` with `Codec`, appends two results
+template<class Codec>
+void bench_codec(const char* codec, const std::string& set, workload::Distribution dist,
+                 const std::vector<u64>& input, std::vector<u64>& output,
+                 MemoryStream& stream, double min_time, std::vector<Result>& results) {
+    CodecPackBench<Codec> pack = { stream, input };
+    CodecUnpackBench<Codec> unpack = { stream, output };
+    pack();
+    const double bytes_per_value = static_cast<double>(stream.size()) / input.size();
+    for (int op = 0; op < 2; op++) {
+        Result r;
+        r.op = std::string(codec) + (op == 0 ? "_pack" : "_unpack");
+        r.set = set;
+        r.width = -1;
+        r.distribution = workload::distribution_name(dist);
+        r.nvalues = input.size();
+        r.name = r.op + "/" + set + "/" + r.distribution;
+        const double ns = op == 0 ? bench::run_benchmark(pack, min_time, &r.iterations)
+                                  : bench::run_benchmark(unpack, min_time, &r.iterations);
+        r.ns_per_value = ns / input.size();
+        r.bytes_per_value = bytes_per_value;
+        results.push_back(r);
+        print_result(r);
+    }
+}
+
+//! Chunked pack and unpack of `input` with 1, 2, 4, ... threads up to `max_threads`
+void bench_chunked(const std::string& set, workload::Distribution dist, int max_threads,
+                   const std::vector<u64>& input, std::vector<u64>& output,
+                   MemoryStream& stream, double min_time, std::vector<Result>& results) {
+    for (int threads = 1; ; threads = std::min(2*threads, max_threads)) {
+        ThreadPool pool(threads);
+        ChunkedPackBench pack = { stream, pool, input };
+        ChunkedUnpackBench unpack = { stream, pool, output };
+        pack();
+        const double bytes_per_value = static_cast<double>(stream.size()) / input.size();
+        for (int op = 0; op < 2; op++) {
+            Result r;
+            r.op = op == 0 ? "chunked_pack" : "chunked_unpack";
+            r.set = set;
+            r.width = -1;
+            r.distribution = workload::distribution_name(dist);
+            r.nvalues = input.size();
+            std::ostringstream name;
+            name << r.op << "/" << set << "/" << r.distribution << "/threads:" << threads;
+            r.name = name.str();
+            const double ns = op == 0 ? bench::run_benchmark(pack, min_time, &r.iterations)
+                                      : bench::run_benchmark(unpack, min_time, &r.iterations);
+            r.ns_per_value = ns / input.size();
+            r.bytes_per_value = bytes_per_value;
+            results.push_back(r);
+            print_result(r);
+        }
+        if (threads >= max_threads) {
+            break;
+        }
+    }
+}
+
+static void write_json(std::ostream& out, const std::vector<Result>& results) {
+    const CpuFeatures& cpu = cpu_features();
+    out << "{\n  \"context\": {\n"
+        << "    \"library\": \"bitpack\",\n"
+        << "    \"avx2\": " << (cpu.avx2 ? "true" : "false") << ",\n"
+        << "    \"avx512f\": " << (cpu.avx512f ? "true" : "false") << ",\n"
+        << "    \"bmi2\": " << (cpu.bmi2 ? "true" : "false") << "\n"
+        << "  },\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"op\": \"" << r.op
+            << "\", \"working_set\": \"" << r.set << "\", "
+            << (r.width >= 0 ? "\"width\": " : "\"distribution\": \"")
+            << (r.width >= 0 ? std::to_string(r.width) : r.distribution + "\"")
+            << ", \"values\": " << r.nvalues << ", \"iterations\": " << r.iterations
+            << ", \"real_time\": " << r.ns_per_value*r.nvalues << ", \"time_unit\": \"ns\""
+            << ", \"ns_per_value\": " << r.ns_per_value
+            << ", \"values_per_second\": " << 1e9 / r.ns_per_value
+            << ", \"bytes_per_value\": " << r.bytes_per_value << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+static Options parse_options(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        const std::string key = arg.substr(0, eq);
+        const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (key == "--json") {
+            options.json = value;
+        } else if (key == "--min-time") {
+            options.min_time = atof(value.c_str());
+        } else if (key == "--width") {
+            options.width = atoi(value.c_str());
+        } else if (key == "--dram") {
+            options.dram = static_cast<size_t>(atol(value.c_str())) << 20;
+        } else if (key == "--distribution") {
+            options.distribution = value;
+        } else if (key == "--threads") {
+            options.threads = std::max(1, atoi(value.c_str()));
+        } else if (key == "--set") {
+            options.set = value;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            exit(1);
+        }
+    }
+    return options;
+}
+
+int main(int argc, char *argv[])
+{
+    const Options options = parse_options(argc, argv);
+    const std::vector<WorkingSet> sets = working_sets(options);
+    std::vector<Result> results;
+    std::cout << "benchmark                              ns/value   Mvalues/s  bytes/value" << std::endl;
+    for (size_t s = 0; s < sets.size(); s++) {
+        if (!options.set.empty() && options.set != sets[s].name) {
+            continue;
+        }
+        const size_t nvalues = std::max<size_t>(16, sets[s].bytes / sizeof(u64) / 16 * 16);
+        std::vector<u64> input(nvalues), output(nvalues);
+        MemoryStream stream(AdaptiveEncoder::max_size(nvalues/16) + 18*nvalues);
+        for (int n = 0; n <= 64; n++) {
+            if ((options.width >= 0 && options.width != n) || !options.distribution.empty()) {
+                continue;
+            }
+            workload::Uniform gen(n == 64 ? ~0ull : (1ull << n) - 1, n);
+            for (size_t i = 0; i < nvalues; i++) {
+                input[i] = gen.generate();
+            }
+            PackBench pack = { stream, input, n };
+            UnpackBench unpack = { stream, output, n };
+            pack();
+            const double bytes_per_value = static_cast<double>(stream.size()) / nvalues;
+            for (int op = 0; op < 2; op++) {
+                Result r;
+                r.op = op == 0 ? "pack" : "unpack";
+                r.set = sets[s].name;
+                r.width = n;
+                r.nvalues = nvalues;
+                std::ostringstream name;
+                name << r.op << "/" << r.set << "/" << n;
+                r.name = name.str();
+                const double ns = op == 0 ? bench::run_benchmark(pack, options.min_time, &r.iterations)
+                                          : bench::run_benchmark(unpack, options.min_time, &r.iterations);
+                r.ns_per_value = ns / nvalues;
+                r.bytes_per_value = bytes_per_value;
+                results.push_back(r);
+                print_result(r);
+            }
+        }
+        for (int d = 0; d < workload::DISTRIBUTION_COUNT; d++) {
+            const workload::Distribution dist = static_cast<workload::Distribution>(d);
+            if (options.width >= 0 ||
+                (!options.distribution.empty() && options.distribution != workload::distribution_name(dist))) {
+                continue;
+            }
+            const std::vector<u64> values = workload::generate(dist, nvalues);
+            bench_codec<AdaptiveEncoder>("adaptive", sets[s].name, dist, values, output, stream, options.min_time, results);
+            bench_codec<ForEncoder>("for", sets[s].name, dist, values, output, stream, options.min_time, results);
+            bench_codec<PforEncoder>("pfor", sets[s].name, dist, values, output, stream, options.min_time, results);
+            bench_codec<DeltaEncoder>("delta", sets[s].name, dist, values, output, stream, options.min_time, results);
+            bench_chunked(sets[s].name, dist, options.threads, values, output, stream, options.min_time, results);
+        }
+    }
+    if (!options.json.empty()) {
+        std::ofstream out(options.json.c_str());
+        write_json(out, results);
+        if (!out) {
+            std::cerr << "Can't write " << options.json << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+
+#include "bitpack.h"
+
+namespace bench {
+
+//! Nanoseconds taken by `iterations` calls of `fn`
+template<class Fn>
+double time_ns(Fn& fn, u64 iterations) {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (u64 i = 0; i < iterations; i++) {
+        fn();
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+//! Best of several runs, nanoseconds per value
+template<class Fn>
+double measure(Fn fn, size_t nvalues) {
+    double best = 1e100;
+    for (int run = 0; run < 5; run++) {
+        const int reps = 20;
+        best = std::min(best, time_ns(fn, reps) / (reps*nvalues));
+    }
+    return best;
+}
+
+/** Run `fn` until `min_time` seconds have passed, doubling the number of
+  * iterations, returns ns per iteration of the final batch.
+  */
+template<class Fn>
+double run_benchmark(Fn& fn, double min_time, u64* iterations) {
+    u64 iters = 1;
+    while (true) {
+        const double elapsed = time_ns(fn, iters);
+        if (elapsed >= min_time*1e9 || iters >= (1ull << 30)) {
+            *iterations = iters;
+            return elapsed / iters;
+        }
+        iters *= 2;
+    }
+}
+
+}  // namespace bench
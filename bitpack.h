@@ -0,0 +1,161 @@
+#pragma once
+#include "stream.h"
+#include "dispatch.h"
+#include "sink.h"
+#include "typed.h"
+
+/** Packs and unpacks 16-value blocks. `Stream` is any sink with
+  * `allocate(size)` for packing (MemoryStream, GrowableSink, BufferSink,
+  * SegmentedSink) or any source with `try_consume(size)` for unpacking
+  * (MemoryStream, BufferSource). Every block is reserved in one call.
+  */
+template<class Stream = MemoryStream>
+class BasicEncoder {
+    Stream &stream_;
+    const KernelTable& kernels_;
+
+    template<class Write, typename T>
+    bool _pack(Write write, const T* input, int n) {
+        u8* out = stream_.allocate(2*n);
+        if (!out) {
+            return false;
+        }
+        write(input, out);
+        return true;
+    }
+
+    template<class Read, typename T>
+    Status _unpack(Read read, T* output, int n) {
+        const u8* in = stream_.try_consume(2*n);
+        if (!in) {
+            return STATUS_END_OF_STREAM;
+        }
+        read(in, output);
+        return STATUS_OK;
+    }
+public:
+    BasicEncoder(Stream& stream, const KernelTable& kernels = best_kernels())
+        : stream_(stream)
+        , kernels_(kernels)
+    {
+    }
+
+    //! Pack 16 values of width `n`, input is not modified. Returns false if the sink is full.
+    bool pack(const u64* input, int n) {
+        if (n < 0 || n > 64) {
+            return false;
+        }
+        return _pack(kernels_.write[n], input, n);
+    }
+
+    /** Unpack 16 values of width `n`, output is overwritten (no need to
+      * zero it). Doesn't throw, stream position is unchanged on error.
+      */
+    Status unpack(u64* output, int n) {
+        if (n < 0 || n > 64) {
+            return STATUS_INVALID_WIDTH;
+        }
+        return _unpack(kernels_.read[n], output, n);
+    }
+
+    /** Pack 16 values of width `n` from a narrow integer array (u8, u16,
+      * u32, i32, i64, ...), same layout as for u64. Returns false if the
+      * width doesn't fit the type or the stream is full.
+      */
+    template<typename T>
+    bool pack(const T* input, int n) {
+        if (n < 0 || n > typed::Table<T>::MAX_WIDTH) {
+            return false;
+        }
+        return _pack(typed::table<T>().write[n], input, n);
+    }
+
+    //! Unpack 16 values of width `n` into a narrow integer array, output is overwritten
+    template<typename T>
+    Status unpack(T* output, int n) {
+        if (n < 0 || n > typed::Table<T>::MAX_WIDTH) {
+            return STATUS_INVALID_WIDTH;
+        }
+        return _unpack(typed::table<T>().read[n], output, n);
+    }
+
+    //! Pack a block of known width, bypasses the kernel table
+    template<int N>
+    bool pack(const u64* input) {
+        return _pack(&BlockKernel<N>::template write<u64>, input, N);
+    }
+
+    template<int N>
+    Status unpack(u64* output) {
+        return _unpack(static_cast<void (*)(const u8*, u64*)>(&BlockKernel<N>::read), output, N);
+    }
+
+    bool dumb_pack(const u64* input, int n) {
+        int size = 16;
+        u8 bits = 0;
+        int ixbits = 0;
+        for (int i = 0; i < size; i++) {
+            u64 word = input[i];
+            for (int ixword = 0; ixword < n; ixword++) {
+                if (word & 1) {
+                    bits |= (1 << ixbits);
+                }
+                ixbits++;
+                word >>= 1;
+                if (ixbits == 8) {
+                    if (!stream_.put_raw(static_cast<u8>(bits))) {
+                        return false;
+                    }
+                    ixbits = 0;
+                    bits = 0;
+                }
+            }
+        }
+        if (ixbits != 0 && n != 0) {
+            if (!stream_.put_raw(static_cast<u8>(bits))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void dumb_unpack(u64* output, int n) {
+        int size = 16;
+        u8 bits = 0;
+        int bitindex = 8;
+        for (auto ixout = 0; ixout < size; ixout++) {
+            u64 current = 0;
+            for (int ixbit = 0; ixbit < n; ixbit++) {
+                if (bitindex == 8) {
+                    bitindex = 0;
+                    bits = stream_.template read_raw<u8>();
+                }
+                if (bits & 1) {
+                    current |= 1ull << ixbit;
+                }
+                bits >>= 1;
+                bitindex++;
+            }
+            output[ixout] = current;
+        }
+    }
+};
+
+typedef BasicEncoder<MemoryStream> Encoder;
+
+//! Number of significant bits, 0 for 0
+inline int get_bit_width(u64 x) {
+    if (x == 0) {
+        return 0;
+    }
+    return 64 - __builtin_clzll(x);
+}
+
+//! Width of the widest value in the 16-value block
+inline int get_block_width(const u64* input) {
+    u64 bits = 0;
+    for (int i = 0; i < 16; i++) {
+        bits |= input[i];
+    }
+    return get_bit_width(bits);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstring>
+#include <string>
+#include <immintrin.h>
+
+#include "cpu.h"
+#include "scalar.h"
+
+//! PDEP/PEXT masks, low R bits of every byte
+static const u64 BMI2_MASKS[8] = {
+    0x0000000000000000ull,
+    0x0101010101010101ull,
+    0x0303030303030303ull,
+    0x0707070707070707ull,
+    0x0F0F0F0F0F0F0F0Full,
+    0x1F1F1F1F1F1F1F1Full,
+    0x3F3F3F3F3F3F3F3Full,
+    0x7F7F7F7F7F7F7F7Full,
+};
+
+/** Tail kernels based on PEXT/PDEP. `Base` narrows the values to bytes,
+  * PEXT compacts eight bytes into `8*R` bits in one instruction and PDEP
+  * spreads them back. 1-bit tail is left to `Base`.
+  */
+template<class Base>
+struct Bmi2Kernels : Base {
+    static const char* name() {
+        static const std::string name = std::string(Base::name()) + "+bmi2";
+        return name.c_str();
+    }
+
+    template<int R>
+    BITPACK_BMI2 static void _packTail(const u64* input, u8* out, int shift) {
+        if (R < 2) {
+            Base::template _packTail<R>(input, out, shift);
+            return;
+        }
+        u64 bytes[2];
+        Base::_narrow8(input, reinterpret_cast<u8*>(bytes), shift);
+        const u64 lo = _pext_u64(bytes[0], BMI2_MASKS[R]);
+        const u64 hi = _pext_u64(bytes[1], BMI2_MASKS[R]);
+        const u64 words[2] = {
+            lo | (hi << ((8*R) & 63)),
+            hi >> ((64 - 8*R) & 63),
+        };
+        std::memcpy(out, words, 2*R);
+    }
+
+    template<int R>
+    BITPACK_BMI2 static void _unpackTail(const u8* in, u8* bytes) {
+        if (R < 2) {
+            Base::template _unpackTail<R>(in, bytes);
+            return;
+        }
+        u64 words[2] = {};
+        std::memcpy(words, in, 2*R);
+        const u64 lo = words[0] & Mask<8*R>::value;
+        const u64 hi = (words[0] >> ((8*R) & 63)) | (words[1] << ((64 - 8*R) & 63));
+        const u64 spread[2] = {
+            _pdep_u64(lo, BMI2_MASKS[R]),
+            _pdep_u64(hi, BMI2_MASKS[R]),
+        };
+        std::memcpy(bytes, spread, sizeof(spread));
+    }
+};
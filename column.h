@@ -0,0 +1,352 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bitpack.h"
+
+/** On-disk column of u64 values, every 16-value block is packed with its
+  * own width. Layout (little-endian):
+  *
+  *   header     magic "BPCOLUMN", u32 version, u32 index stride,
+  *              u64 number of values, u64 payload size
+  *   payload    packed blocks one after another, last block zero-padded
+  *   directory  u8 width of every block, zero-padded to 8 bytes, then
+  *              u64 payload offset of every `stride`-th block
+  *
+  * The directory follows the payload so the writer can stream blocks out
+  * and patch the header on close.
+  */
+namespace column {
+
+enum {
+    VERSION = 1,
+    HEADER_SIZE = 32,
+    DEFAULT_STRIDE = 64,
+};
+
+static const char MAGIC[8] = {'B', 'P', 'C', 'O', 'L', 'U', 'M', 'N'};
+
+struct Header {
+    u32 version;
+    u32 stride;
+    u64 count;
+    u64 payload_size;
+};
+
+inline void write_header(const Header& header, u8* out) {
+    std::memcpy(out, MAGIC, sizeof(MAGIC));
+    std::memcpy(out + 8, &header.version, sizeof(header.version));
+    std::memcpy(out + 12, &header.stride, sizeof(header.stride));
+    std::memcpy(out + 16, &header.count, sizeof(header.count));
+    std::memcpy(out + 24, &header.payload_size, sizeof(header.payload_size));
+}
+
+inline Header read_header(const u8* input) {
+    if (std::memcmp(input, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error("Not a column file");
+    }
+    Header header;
+    std::memcpy(&header.version, input + 8, sizeof(header.version));
+    std::memcpy(&header.stride, input + 12, sizeof(header.stride));
+    std::memcpy(&header.count, input + 16, sizeof(header.count));
+    std::memcpy(&header.payload_size, input + 24, sizeof(header.payload_size));
+    if (header.version != VERSION) {
+        throw std::runtime_error("Unsupported column file version");
+    }
+    return header;
+}
+
+//! Bytes taken by the width run and the offset index of `nblocks` blocks
+inline u64 directory_size(u64 nblocks, u32 stride) {
+    return (nblocks + 7) / 8 * 8 + 8*((nblocks + stride - 1) / stride);
+}
+
+}  // namespace column
+
+/** Streams blocks to a column file. Values are buffered until a block
+  * is complete, the directory is kept in memory (one byte per block) and
+  * written by `close`.
+  */
+class ColumnWriter {
+    std::FILE* file_;
+    const KernelTable& kernels_;
+    u32 stride_;
+    u64 count_;
+    u64 payload_size_;
+    std::vector<u8> widths_;
+    std::vector<u64> offsets_;
+    u64 pending_[16];
+    int npending_;
+
+    void _write(const void* data, size_t size) {
+        if (size && std::fwrite(data, 1, size, file_) != size) {
+            throw std::runtime_error("Can't write column file");
+        }
+    }
+
+    void _flush_block(const u64* block) {
+        const int n = get_block_width(block);
+        if (widths_.size() % stride_ == 0) {
+            offsets_.push_back(payload_size_);
+        }
+        widths_.push_back(static_cast<u8>(n));
+        u8 out[128];
+        kernels_.write[n](block, out);
+        _write(out, 2*n);
+        payload_size_ += 2*n;
+    }
+public:
+    explicit ColumnWriter(const std::string& path,
+                          const KernelTable& kernels = best_kernels(),
+                          u32 stride = column::DEFAULT_STRIDE)
+        : file_(nullptr)
+        , kernels_(kernels)
+        , stride_(stride)
+        , count_(0)
+        , payload_size_(0)
+        , npending_(0)
+    {
+        if (stride == 0) {
+            throw std::invalid_argument("Invalid index stride");
+        }
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) {
+            throw std::runtime_error("Can't open " + path);
+        }
+        const u8 header[column::HEADER_SIZE] = {};
+        _write(header, sizeof(header));
+    }
+
+    ColumnWriter(const ColumnWriter&) = delete;
+    ColumnWriter& operator = (const ColumnWriter&) = delete;
+
+    ~ColumnWriter() {
+        if (file_) {
+            try {
+                close();
+            } catch (...) {
+            }
+        }
+    }
+
+    //! Append `count` values, full blocks are packed straight from `input`
+    void append(const u64* input, size_t count) {
+        if (!file_) {
+            throw std::logic_error("Column file is closed");
+        }
+        count_ += count;
+        while (count && npending_) {
+            pending_[npending_++] = *input++;
+            count--;
+            if (npending_ == 16) {
+                _flush_block(pending_);
+                npending_ = 0;
+            }
+        }
+        for (; count >= 16; input += 16, count -= 16) {
+            _flush_block(input);
+        }
+        std::copy(input, input + count, pending_);
+        npending_ += static_cast<int>(count);
+    }
+
+    //! Flush the last block, write the directory and the header
+    void close() {
+        if (!file_) {
+            return;
+        }
+        std::FILE* file = file_;
+        try {
+            if (npending_) {
+                std::fill(pending_ + npending_, pending_ + 16, 0ull);
+                _flush_block(pending_);
+                npending_ = 0;
+            }
+            widths_.resize((widths_.size() + 7) / 8 * 8, 0);
+            _write(widths_.data(), widths_.size());
+            _write(offsets_.data(), sizeof(u64)*offsets_.size());
+            const column::Header header = { column::VERSION, stride_, count_, payload_size_ };
+            u8 out[column::HEADER_SIZE];
+            column::write_header(header, out);
+            if (std::fseek(file_, 0, SEEK_SET) != 0) {
+                throw std::runtime_error("Can't write column file");
+            }
+            _write(out, sizeof(out));
+        } catch (...) {
+            file_ = nullptr;
+            std::fclose(file);
+            throw;
+        }
+        file_ = nullptr;
+        if (std::fclose(file) != 0) {
+            throw std::runtime_error("Can't write column file");
+        }
+    }
+};
+
+/** Maps a column file and decodes blocks straight from the mapped
+  * pages. Opening only reads the header, pages are faulted in by the
+  * blocks that are actually decoded. Block position is found from the
+  * closest indexed block by summing at most `stride - 1` widths.
+  */
+class ColumnReader {
+    int fd_;
+    const u8* data_;
+    size_t size_;
+    column::Header header_;
+    u64 nblocks_;
+    const u8* payload_;
+    const u8* widths_;
+    const u8* offsets_;
+    const KernelTable& kernels_;
+
+    void _close() {
+        if (data_) {
+            munmap(const_cast<u8*>(data_), size_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    void _check_block(u64 block) const {
+        if (block >= nblocks_) {
+            throw std::out_of_range("Index out of range");
+        }
+    }
+
+    //! Payload offset of the block
+    u64 _offset(u64 block) const {
+        u64 offset;
+        std::memcpy(&offset, offsets_ + 8*(block / header_.stride), sizeof(offset));
+        for (u64 b = block - block % header_.stride; b < block; b++) {
+            offset += 2*widths_[b];
+        }
+        return offset;
+    }
+
+    //! Decode the block of width `n` at payload `offset`
+    void _decode(u64 offset, int n, u64* output) const {
+        if (n > 64 || offset + 2*n > header_.payload_size) {
+            throw std::out_of_range("Corrupted stream");
+        }
+        kernels_.read[n](payload_ + offset, output);
+    }
+public:
+    explicit ColumnReader(const std::string& path, const KernelTable& kernels = best_kernels())
+        : fd_(-1)
+        , data_(nullptr)
+        , size_(0)
+        , kernels_(kernels)
+    {
+        try {
+            fd_ = ::open(path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd_ < 0 || fstat(fd_, &st) != 0) {
+                throw std::runtime_error("Can't open " + path);
+            }
+            size_ = static_cast<size_t>(st.st_size);
+            if (size_ < column::HEADER_SIZE) {
+                throw std::runtime_error("Not a column file");
+            }
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+            if (data == MAP_FAILED) {
+                throw std::runtime_error("Can't map " + path);
+            }
+            data_ = static_cast<const u8*>(data);
+            header_ = column::read_header(data_);
+            nblocks_ = (header_.count + 15) / 16;
+            if (header_.stride == 0 || header_.payload_size > size_ ||
+                size_ - column::HEADER_SIZE - header_.payload_size !=
+                    column::directory_size(nblocks_, header_.stride)) {
+                throw std::runtime_error("Corrupted column file");
+            }
+        } catch (...) {
+            _close();
+            throw;
+        }
+        payload_ = data_ + column::HEADER_SIZE;
+        widths_ = payload_ + header_.payload_size;
+        offsets_ = widths_ + (nblocks_ + 7) / 8 * 8;
+    }
+
+    ColumnReader(const ColumnReader&) = delete;
+    ColumnReader& operator = (const ColumnReader&) = delete;
+
+    ~ColumnReader() {
+        _close();
+    }
+
+    //! Number of values
+    u64 size() const {
+        return header_.count;
+    }
+
+    u64 nblocks() const {
+        return nblocks_;
+    }
+
+    int width(u64 block) const {
+        _check_block(block);
+        return widths_[block];
+    }
+
+    //! Packed bytes of the block inside the mapping
+    const u8* block_data(u64 block) const {
+        _check_block(block);
+        return payload_ + _offset(block);
+    }
+
+    //! Decode all 16 values of the block, padding of the last block is zero
+    void unpack_block(u64 block, u64* output) const {
+        _check_block(block);
+        _decode(_offset(block), widths_[block], output);
+    }
+
+    //! Value at position `i`
+    u64 get(u64 i) const {
+        if (i >= size()) {
+            throw std::out_of_range("Index out of range");
+        }
+        u64 block[16];
+        unpack_block(i / 16, block);
+        return block[i % 16];
+    }
+
+    //! Decode values [first, last) into `output`, blocks after the first one are read sequentially
+    void decode_range(u64 first, u64 last, u64* output) const {
+        if (first > last || last > size()) {
+            throw std::out_of_range("Index out of range");
+        }
+        if (first == last) {
+            return;
+        }
+        u64 block = first / 16;
+        u64 offset = _offset(block);
+        while (first < last) {
+            const int n = widths_[block];
+            const u64 begin = first % 16;
+            const u64 end = std::min<u64>(16, begin + last - first);
+            if (begin == 0 && end == 16) {
+                _decode(offset, n, output);
+            } else {
+                u64 values[16];
+                _decode(offset, n, values);
+                std::copy(values + begin, values + end, output);
+            }
+            output += end - begin;
+            first += end - begin;
+            offset += 2*n;
+            block++;
+        }
+    }
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <cpuid.h>
+
+#define BITPACK_SSE41  __attribute__((target("sse4.1")))
+#define BITPACK_AVX2   __attribute__((target("avx2")))
+#define BITPACK_BMI2   __attribute__((target("bmi2")))
+#define BITPACK_AVX512 __attribute__((target("avx2,avx512f")))
+#define BITPACK_AVX512BW __attribute__((target("avx2,bmi2,avx512f,avx512bw,avx512vl")))
+
+struct CpuFeatures {
+    bool sse41;
+    bool avx2;
+    bool bmi2;
+    //! PDEP/PEXT are microcoded (and slow) on AMD before Zen 3
+    bool fast_pdep;
+    bool avx512f;
+    bool avx512bw;
+    bool avx512vl;
+};
+
+//! Read extended control register, tells which register files the OS saves
+inline unsigned long long _read_xcr0() {
+    unsigned lo, hi;
+    __asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<unsigned long long>(hi) << 32) | lo;
+}
+
+inline CpuFeatures detect_cpu_features() {
+    CpuFeatures features = {};
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+        return features;
+    }
+    // "AuthenticAMD"
+    const bool amd = ebx == 0x68747541 && edx == 0x69746e65 && ecx == 0x444d4163;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return features;
+    }
+    const unsigned family = ((eax >> 8) & 0xF) + (((eax >> 8) & 0xF) == 0xF ? (eax >> 20) & 0xFF : 0);
+    features.sse41 = (ecx & bit_SSE4_1) != 0;
+    const bool avx = (ecx & bit_AVX) != 0;
+    const unsigned long long xcr0 = (ecx & bit_OSXSAVE) ? _read_xcr0() : 0;
+    // XMM and YMM state for AVX, plus opmask and ZMM state for AVX-512
+    const bool ymm_enabled = (xcr0 & 0x06) == 0x06;
+    const bool zmm_enabled = (xcr0 & 0xE6) == 0xE6;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        features.avx2 = avx && ymm_enabled && (ebx & bit_AVX2) != 0;
+        features.bmi2 = (ebx & bit_BMI2) != 0;
+        features.fast_pdep = features.bmi2 && !(amd && family < 0x19);
+        features.avx512f = features.avx2 && zmm_enabled && (ebx & bit_AVX512F) != 0;
+        features.avx512bw = features.avx512f && (ebx & bit_AVX512BW) != 0;
+        features.avx512vl = features.avx512f && (ebx & bit_AVX512VL) != 0;
+    }
+    return features;
+}
+
+//! Features of the host CPU, detected once
+inline const CpuFeatures& cpu_features() {
+    static const CpuFeatures features = detect_cpu_features();
+    return features;
+}
@@ -0,0 +1,291 @@
+#pragma once
+#include <cstring>
+#include <immintrin.h>
+
+#include "bitpack.h"
+#include "cpu.h"
+
+/** Delta and delta-of-delta block codec for timestamps and counters.
+  * Block header is `u8 mode << 7 | width` and the first value, the
+  * delta-of-delta mode also stores the first delta. Residuals are
+  * zigzag encoded and packed with the width kernels. The scalar decode
+  * restores the values inside the unpack loop, the SIMD variants unpack
+  * the block and then undo the zigzag and every prefix step in a single
+  * pass over registers.
+  */
+namespace delta {
+
+enum Mode {
+    DELTA = 0,
+    DELTA_OF_DELTA = 1,
+};
+
+inline u64 zigzag(u64 x) {
+    return (x << 1) ^ static_cast<u64>(static_cast<i64>(x) >> 63);
+}
+
+inline u64 unzigzag(u64 x) {
+    return (x >> 1) ^ (0 - (x & 1));
+}
+
+/** Policy of BlockKernel::decode, restores the values from zigzag
+  * encoded residuals. Deltas of deltas start from the first delta,
+  * which is also the delta of the first value, so the running value
+  * starts from `base - first`.
+  */
+template<int MODE>
+struct Restore {
+    u64* output;
+    u64 value;
+    u64 step;
+
+    Restore(u64* output, u64 base, u64 first)
+        : output(output)
+        , value(MODE == DELTA_OF_DELTA ? base - first : base)
+        , step(first)
+    {
+    }
+
+    void operator () (int i, u64 residual) {
+        if (MODE == DELTA_OF_DELTA) {
+            step += unzigzag(residual);
+            value += step;
+        } else {
+            value += unzigzag(residual);
+        }
+        output[i] = value;
+    }
+};
+
+typedef void (*UnpackFn)(const u8* input, u64* output, u64 base, u64 first);
+
+template<int MODE, int N>
+struct Kernel {
+    static void unpack(const u8* input, u64* output, u64 base, u64 first) {
+        Restore<MODE> op(output, base, first);
+        BlockKernel<N>::decode(input, op);
+    }
+};
+
+template<int N>
+struct Fill {
+    static void run(UnpackFn (*table)[65]) {
+        table[DELTA][N] = &Kernel<DELTA, N>::unpack;
+        table[DELTA_OF_DELTA][N] = &Kernel<DELTA_OF_DELTA, N>::unpack;
+        Fill<N - 1>::run(table);
+    }
+};
+
+template<>
+struct Fill<-1> {
+    static void run(UnpackFn (*)[65]) {
+    }
+};
+
+struct UnpackTable {
+    UnpackFn unpack[2][65];
+
+    UnpackTable() {
+        Fill<64>::run(unpack);
+    }
+};
+
+//! Fused decode kernels for both modes and widths 0-64
+inline const UnpackTable& unpack_table() {
+    static const UnpackTable table;
+    return table;
+}
+
+/** Restore 16 unpacked residuals in place. Every register is loaded
+  * and stored once: zigzag decode, prefix sum of the deltas and, for
+  * delta-of-delta, the second prefix sum all happen in registers, with
+  * the running totals carried from register to register.
+  */
+template<int MODE>
+struct PrefixSum {
+    BITPACK_AVX2 static __m256i avx2_sum(__m256i x) {
+        const __m256i zero = _mm256_setzero_si256();
+        // [a, a+b | c, c+d], then add a+b to the upper half
+        x = _mm256_add_epi64(x, _mm256_slli_si256(x, 8));
+        return _mm256_add_epi64(x, _mm256_blend_epi32(zero, _mm256_permute4x64_epi64(x, 0x55), 0xF0));
+    }
+
+    BITPACK_AVX2 static void avx2(u64* values, u64 base, u64 first) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi64x(1);
+        __m256i acc = _mm256_set1_epi64x(static_cast<i64>(MODE == DELTA_OF_DELTA ? base - first : base));
+        __m256i step = _mm256_set1_epi64x(static_cast<i64>(first));
+        for (int i = 0; i < 16; i += 4) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+            x = _mm256_xor_si256(_mm256_srli_epi64(x, 1),
+                                 _mm256_sub_epi64(zero, _mm256_and_si256(x, one)));
+            if (MODE == DELTA_OF_DELTA) {
+                x = _mm256_add_epi64(avx2_sum(x), step);
+                step = _mm256_permute4x64_epi64(x, 0xFF);
+            }
+            x = _mm256_add_epi64(avx2_sum(x), acc);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + i), x);
+            acc = _mm256_permute4x64_epi64(x, 0xFF);
+        }
+    }
+
+    BITPACK_AVX512 static __m512i avx512_sum(__m512i x) {
+        const __m512i zero = _mm512_setzero_si512();
+        // shift by 1, 2 and 4 lanes, zeroes shifted in
+        x = _mm512_add_epi64(x, _mm512_alignr_epi64(x, zero, 7));
+        x = _mm512_add_epi64(x, _mm512_alignr_epi64(x, zero, 6));
+        return _mm512_add_epi64(x, _mm512_alignr_epi64(x, zero, 4));
+    }
+
+    BITPACK_AVX512 static void avx512(u64* values, u64 base, u64 first) {
+        const __m512i zero = _mm512_setzero_si512();
+        const __m512i one = _mm512_set1_epi64(1);
+        const __m512i last = _mm512_set1_epi64(7);
+        __m512i acc = _mm512_set1_epi64(static_cast<i64>(MODE == DELTA_OF_DELTA ? base - first : base));
+        __m512i step = _mm512_set1_epi64(static_cast<i64>(first));
+        for (int i = 0; i < 16; i += 8) {
+            __m512i x = _mm512_loadu_si512(values + i);
+            x = _mm512_xor_si512(_mm512_srli_epi64(x, 1),
+                                 _mm512_sub_epi64(zero, _mm512_and_si512(x, one)));
+            if (MODE == DELTA_OF_DELTA) {
+                x = _mm512_add_epi64(avx512_sum(x), step);
+                step = _mm512_permutexvar_epi64(last, x);
+            }
+            x = _mm512_add_epi64(avx512_sum(x), acc);
+            _mm512_storeu_si512(values + i, x);
+            acc = _mm512_permutexvar_epi64(last, x);
+        }
+    }
+};
+
+/** Block decode for one mode: `input` is the packed block of width `n`,
+  * `kernels` unpack it when the decode isn't fused.
+  */
+typedef void (*DecodeFn)(const KernelTable& kernels, int n, const u8* input,
+                         u64* output, u64 base, u64 first);
+
+template<int MODE>
+struct Decode {
+    static void scalar(const KernelTable&, int n, const u8* input, u64* output, u64 base, u64 first) {
+        unpack_table().unpack[MODE][n](input, output, base, first);
+    }
+
+    static void avx2(const KernelTable& kernels, int n, const u8* input, u64* output, u64 base, u64 first) {
+        kernels.read[n](input, output);
+        PrefixSum<MODE>::avx2(output, base, first);
+    }
+
+    static void avx512(const KernelTable& kernels, int n, const u8* input, u64* output, u64 base, u64 first) {
+        kernels.read[n](input, output);
+        PrefixSum<MODE>::avx512(output, base, first);
+    }
+};
+
+struct PrefixSumKernels {
+    const char* name;
+    //! Indexed by Mode
+    DecodeFn decode[2];
+};
+
+inline const PrefixSumKernels& scalar_kernels() {
+    static const PrefixSumKernels kernels = {
+        "scalar", { &Decode<DELTA>::scalar, &Decode<DELTA_OF_DELTA>::scalar }
+    };
+    return kernels;
+}
+
+inline const PrefixSumKernels& avx2_kernels() {
+    static const PrefixSumKernels kernels = {
+        "avx2", { &Decode<DELTA>::avx2, &Decode<DELTA_OF_DELTA>::avx2 }
+    };
+    return kernels;
+}
+
+inline const PrefixSumKernels& avx512_kernels() {
+    static const PrefixSumKernels kernels = {
+        "avx512", { &Decode<DELTA>::avx512, &Decode<DELTA_OF_DELTA>::avx512 }
+    };
+    return kernels;
+}
+
+inline const PrefixSumKernels& best_kernels() {
+    if (cpu_features().avx512f) {
+        return avx512_kernels();
+    }
+    if (cpu_features().avx2) {
+        return avx2_kernels();
+    }
+    return scalar_kernels();
+}
+
+}  // namespace delta
+
+class DeltaEncoder {
+    MemoryStream &stream_;
+    const KernelTable& kernels_;
+    const delta::PrefixSumKernels& prefix_;
+public:
+    DeltaEncoder(MemoryStream& stream,
+                 const KernelTable& kernels = best_kernels(),
+                 const delta::PrefixSumKernels& prefix = delta::best_kernels())
+        : stream_(stream)
+        , kernels_(kernels)
+        , prefix_(prefix)
+    {
+    }
+
+    /** Pack 16 values, the mode with the smaller encoded size is chosen
+      * per block. Returns false if the stream is full.
+      */
+    bool pack(const u64* input) {
+        // deltas start from input[0] (first residual is 0), deltas of
+        // deltas start from the first delta (first two residuals are 0)
+        const u64 first = input[1] - input[0];
+        u64 deltas[16];
+        u64 ddeltas[16];
+        u64 prev = input[0];
+        u64 prev_delta = first;
+        for (int i = 0; i < 16; i++) {
+            const u64 d = input[i] - prev;
+            deltas[i] = delta::zigzag(d);
+            ddeltas[i] = delta::zigzag(i == 0 ? 0 : d - prev_delta);
+            prev = input[i];
+            prev_delta = i == 0 ? first : d;
+        }
+        const int n = get_block_width(deltas);
+        const int dn = get_block_width(ddeltas);
+        const bool dod = 2*dn + 8 < 2*n;
+        const int width = dod ? dn : n;
+        u8* header = stream_.allocate(dod ? 17 : 9);
+        if (!header) {
+            return false;
+        }
+        header[0] = static_cast<u8>((dod ? delta::DELTA_OF_DELTA : delta::DELTA) << 7 | width);
+        std::memcpy(header + 1, input, sizeof(u64));
+        if (dod) {
+            std::memcpy(header + 9, &first, sizeof(first));
+        }
+        return kernels_.pack[width](stream_, dod ? ddeltas : deltas);
+    }
+
+    //! Unpack 16 values, output is overwritten
+    void unpack(u64* output) {
+        const u8* header = stream_.consume(9);
+        const int mode = header[0] >> 7;
+        const int n = header[0] & 0x7F;
+        if (n > 64) {
+            throw std::out_of_range("Invalid bit width");
+        }
+        u64 base;
+        std::memcpy(&base, header + 1, sizeof(base));
+        u64 first = 0;
+        if (mode == delta::DELTA_OF_DELTA) {
+            std::memcpy(&first, stream_.consume(sizeof(first)), sizeof(first));
+        }
+        const u8* input = stream_.try_consume(2*n);
+        if (!input) {
+            throw std::out_of_range("End-Of-Stream");
+        }
+        prefix_.decode[mode](kernels_, n, input, output, base, first);
+    }
+};
@@ -0,0 +1,296 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+
+#include "bitpack.h"
+#include "cpu.h"
+#include "scan.h"
+
+/** Dictionary codec for low-cardinality columns (host ids, metric ids,
+  * enums). Values are mapped to dense codes, codes are packed with the
+  * width kernels at `ceil(log2(cardinality))` bits. Codes follow the
+  * value order, so a range predicate on values is a range of codes and
+  * runs on the packed codes. Stream layout:
+  *
+  *   u32 cardinality, u8 width, sorted distinct values (u64 each),
+  *   codes in 16-value blocks of `width` bits, last block zero-padded
+  */
+namespace dict {
+
+enum {
+    HEADER_SIZE = 5,
+};
+
+/** Open-addressing hash table from values to codes, linear probing over
+  * a power-of-two array of (value, code) slots kept at most half full.
+  * Codes are assigned in insertion order until `sort` renumbers them.
+  */
+class Dictionary {
+    struct Slot {
+        u64 value;
+        u32 code;
+    };
+
+    enum : u32 {
+        EMPTY = ~0u,
+    };
+
+    std::vector<Slot> slots_;
+    std::vector<u64> values_;
+    //! 64 - log2(number of slots)
+    int shift_;
+
+    //! Fibonacci hashing, the top bits of the product index the slot
+    size_t _slot(u64 value) const {
+        return static_cast<size_t>((value * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+
+    void _rehash(size_t nslots) {
+        shift_ = 64 - get_bit_width(nslots - 1);
+        const Slot empty = { 0, EMPTY };
+        slots_.assign(nslots, empty);
+        const size_t mask = nslots - 1;
+        for (size_t code = 0; code < values_.size(); code++) {
+            size_t i = _slot(values_[code]);
+            while (slots_[i].code != EMPTY) {
+                i = (i + 1) & mask;
+            }
+            slots_[i].value = values_[code];
+            slots_[i].code = static_cast<u32>(code);
+        }
+    }
+public:
+    explicit Dictionary(size_t capacity = 16) {
+        _rehash(size_t(1) << get_bit_width(2*std::max<size_t>(capacity, 1) - 1));
+    }
+
+    //! Code of `value`, a new code is assigned to a value seen for the first time
+    u32 insert(u64 value) {
+        const size_t mask = slots_.size() - 1;
+        size_t i = _slot(value);
+        for (; slots_[i].code != EMPTY; i = (i + 1) & mask) {
+            if (slots_[i].value == value) {
+                return slots_[i].code;
+            }
+        }
+        if (values_.size() == EMPTY) {
+            throw std::length_error("Dictionary is full");
+        }
+        const u32 code = static_cast<u32>(values_.size());
+        values_.push_back(value);
+        slots_[i].value = value;
+        slots_[i].code = code;
+        if (2*values_.size() > slots_.size()) {
+            _rehash(2*slots_.size());
+        }
+        return code;
+    }
+
+    //! Looks up the code of `value`, returns false if it's not in the dictionary
+    bool find(u64 value, u32* code) const {
+        const size_t mask = slots_.size() - 1;
+        for (size_t i = _slot(value); slots_[i].code != EMPTY; i = (i + 1) & mask) {
+            if (slots_[i].value == value) {
+                *code = slots_[i].code;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Renumber the codes in value order, returns the new code of every
+      * old code.
+      */
+    std::vector<u32> sort() {
+        std::vector<u32> order(values_.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = static_cast<u32>(i);
+        }
+        std::sort(order.begin(), order.end(), [this](u32 a, u32 b) {
+            return values_[a] < values_[b];
+        });
+        std::vector<u32> remap(values_.size());
+        std::vector<u64> sorted(values_.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            remap[order[i]] = static_cast<u32>(i);
+            sorted[i] = values_[order[i]];
+        }
+        values_.swap(sorted);
+        _rehash(slots_.size());
+        return remap;
+    }
+
+    //! Number of distinct values
+    size_t size() const {
+        return values_.size();
+    }
+
+    u64 value(u32 code) const {
+        return values_[code];
+    }
+
+    //! Values by code
+    const u64* values() const {
+        return values_.data();
+    }
+
+    //! Bits per code, `ceil(log2(size()))`
+    int width() const {
+        return values_.empty() ? 0 : get_bit_width(values_.size() - 1);
+    }
+};
+
+typedef void (*GatherFn)(const u64* values, const u64* codes, size_t n, u64* output);
+
+//! `output[i] = values[codes[i]]`
+inline void gather_scalar(const u64* values, const u64* codes, size_t n, u64* output) {
+    for (size_t i = 0; i < n; i++) {
+        output[i] = values[codes[i]];
+    }
+}
+
+BITPACK_AVX2 inline void gather_avx2(const u64* values, const u64* codes, size_t n, u64* output) {
+    const long long* base = reinterpret_cast<const long long*>(values);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256i ix = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_i64gather_epi64(base, ix, 8));
+    }
+    gather_scalar(values, codes + i, n - i, output + i);
+}
+
+BITPACK_AVX512 inline void gather_avx512(const u64* values, const u64* codes, size_t n, u64* output) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m512i ix = _mm512_loadu_si512(codes + i);
+        _mm512_storeu_si512(output + i, _mm512_i64gather_epi64(ix, values, 8));
+    }
+    gather_scalar(values, codes + i, n - i, output + i);
+}
+
+inline GatherFn best_gather() {
+    if (cpu_features().avx512f) {
+        return &gather_avx512;
+    }
+    if (cpu_features().avx2) {
+        return &gather_avx2;
+    }
+    return &gather_scalar;
+}
+
+}  // namespace dict
+
+class DictionaryEncoder {
+    MemoryStream &stream_;
+    const KernelTable& kernels_;
+    dict::GatherFn gather_;
+
+    //! Read the header and the values, returns the values
+    const u8* _read_header(u32* cardinality, int* width) {
+        const u8* header = stream_.consume(dict::HEADER_SIZE);
+        std::memcpy(cardinality, header, sizeof(*cardinality));
+        *width = header[4];
+        if (*width > 32 || (*cardinality && *width != get_bit_width(*cardinality - 1))) {
+            throw std::out_of_range("Corrupted stream");
+        }
+        return stream_.consume(8*static_cast<size_t>(*cardinality));
+    }
+public:
+    DictionaryEncoder(MemoryStream& stream,
+                      const KernelTable& kernels = best_kernels(),
+                      dict::GatherFn gather = dict::best_gather())
+        : stream_(stream)
+        , kernels_(kernels)
+        , gather_(gather)
+    {
+    }
+
+    //! Worst case size of `count` values in bytes (all distinct)
+    static size_t max_size(size_t count) {
+        return dict::HEADER_SIZE + 8*count + (count + 15) / 16 * 64;
+    }
+
+    /** Pack `count` values, the dictionary is built from them and stored
+      * first. Returns false if the stream is full.
+      */
+    bool pack(const u64* input, size_t count) {
+        dict::Dictionary dictionary;
+        std::vector<u32> codes(count);
+        for (size_t i = 0; i < count; i++) {
+            codes[i] = dictionary.insert(input[i]);
+        }
+        const std::vector<u32> remap = dictionary.sort();
+        const u32 cardinality = static_cast<u32>(dictionary.size());
+        const int n = dictionary.width();
+        u8* header = stream_.allocate(dict::HEADER_SIZE + 8*dictionary.size());
+        if (!header) {
+            return false;
+        }
+        std::memcpy(header, &cardinality, sizeof(cardinality));
+        header[4] = static_cast<u8>(n);
+        std::memcpy(header + dict::HEADER_SIZE, dictionary.values(), 8*dictionary.size());
+        for (size_t i = 0; i < count; i += 16) {
+            u64 block[16] = {};
+            for (size_t j = i; j < std::min(count, i + 16); j++) {
+                block[j - i] = remap[codes[j]];
+            }
+            if (!kernels_.pack[n](stream_, block)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //! Unpack `count` values written by one `pack` call, output is overwritten
+    void unpack(u64* output, size_t count) {
+        u32 cardinality;
+        int n;
+        const u8* input = _read_header(&cardinality, &n);
+        if (count && !cardinality) {
+            throw std::out_of_range("Corrupted stream");
+        }
+        std::vector<u64> values(cardinality);
+        std::memcpy(values.data(), input, 8*values.size());
+        const u64 last = cardinality - 1;
+        for (size_t i = 0; i < count; i += 16) {
+            u64 codes[16];
+            if (!kernels_.unpack[n](stream_, codes)) {
+                throw std::out_of_range("End-Of-Stream");
+            }
+            // codes of a corrupted stream can be past the last value
+            for (int j = 0; j < 16; j++) {
+                codes[j] = std::min(codes[j], last);
+            }
+            gather_(values.data(), codes, std::min<size_t>(16, count - i), output + i);
+        }
+    }
+
+    /** Selection bitmap of values in [lo, hi] for `count` values written
+      * by one `pack` call (see scan.h), bits past `count` are cleared.
+      * The range is translated to codes, the packed codes are scanned
+      * without decoding.
+      */
+    void scan_range(u64 lo, u64 hi, size_t count, u8* bitmap,
+                    const scan::ScanTable& table = scan::best_table()) {
+        u32 cardinality;
+        int n;
+        const u8* input = _read_header(&cardinality, &n);
+        std::vector<u64> values(cardinality);
+        std::memcpy(values.data(), input, 8*values.size());
+        const u64 first = std::lower_bound(values.begin(), values.end(), lo) - values.begin();
+        const u64 last = std::upper_bound(values.begin(), values.end(), hi) - values.begin();
+        const size_t nblocks = (count + 15) / 16;
+        Scanner scanner(stream_, table);
+        if (lo > hi || first >= last) {
+            // empty code range
+            scanner.scan_range(n, nblocks, 1, 0, bitmap);
+        } else {
+            scanner.scan_range(n, nblocks, first, last - 1, bitmap);
+        }
+        for (size_t i = count; i < 16*nblocks; i++) {
+            bitmap[i / 8] &= static_cast<u8>(~(1u << i % 8));
+        }
+    }
+};
@@ -0,0 +1,181 @@
+#pragma once
+#include <algorithm>
+
+#include "cpu.h"
+#include "scalar.h"
+#include "simd.h"
+#include "bmi2.h"
+
+/** Pack/unpack for every width composed from the plane kernels of `Kernels`.
+  * Widths are split into 32, 16 and 8-bit planes followed by the tail
+  * (same order as in the scalar layout), 64 is stored as is. Stream is
+  * checked once per block, plane kernels work on raw pointers.
+  */
+template<class Kernels, int N>
+struct Chain {
+    typedef BlockKernel<N> K;
+
+    //! Every plane is extracted from the input in registers, input is not modified
+    static void write(const u64* input, u8* out) {
+        if (N == 64) {
+            Kernels::template _packN<u64>(input, out, 0);
+            return;
+        }
+        if (K::HAS32 != 0) {
+            Kernels::template _packN<u32>(input, out, 0);
+        }
+        if (K::HAS16 != 0) {
+            Kernels::template _packN<u16>(input, out + K::OFFSET16, K::SHIFT16);
+        }
+        if (K::HAS8 != 0) {
+            Kernels::template _packN<u8>(input, out + K::OFFSET8, K::SHIFT8);
+        }
+        if (K::TAIL != 0) {
+            Kernels::template _packTail<K::TAIL>(input, out + K::OFFSET_TAIL, K::SHIFT_TAIL);
+        }
+    }
+
+    //! Planes of every value are combined in registers, the output is written once
+    static void read(const u8* in, u64* output) {
+        if (N == 0) {
+            std::fill(output, output + 16, 0ull);
+            return;
+        }
+        if (N < 8) {
+            // tail only, nothing to combine
+            BlockKernel<N>::read(in, output);
+            return;
+        }
+        u8 tail[16];
+        if (K::TAIL != 0) {
+            Kernels::template _unpackTail<K::TAIL>(in + K::OFFSET_TAIL, tail);
+        }
+        Kernels::template _read<N>(in, tail, output);
+    }
+
+    //! Returns false if the stream is full
+    static bool pack(MemoryStream& stream, const u64* input) {
+        u8* out = stream.allocate(K::SIZE);
+        if (!out) {
+            return false;
+        }
+        write(input, out);
+        return true;
+    }
+
+    //! Returns false if the stream is too short
+    static bool unpack(MemoryStream& stream, u64* output) {
+        const u8* in = stream.try_consume(K::SIZE);
+        if (!in) {
+            return false;
+        }
+        read(in, output);
+        return true;
+    }
+};
+
+//! Pack/unpack functions for widths 0-64
+struct KernelTable {
+    //! Both return false if the stream is too short, nothing is thrown
+    typedef bool (*PackFn)(MemoryStream& stream, const u64* input);
+    typedef bool (*UnpackFn)(MemoryStream& stream, u64* output);
+    //! Encode/decode one block in place, `2*N` bytes
+    typedef void (*WriteFn)(const u64* input, u8* output);
+    typedef void (*ReadFn)(const u8* input, u64* output);
+
+    PackFn pack[65];
+    UnpackFn unpack[65];
+    WriteFn write[65];
+    ReadFn read[65];
+    //! Implementation bound to each width
+    const char* names[65];
+};
+
+//! SIMD plane kernels are chained, scalar kernels are generated per width
+template<class Kernels, int N>
+struct WidthKernel {
+    typedef Chain<Kernels, N> type;
+};
+
+template<int N>
+struct WidthKernel<ScalarKernels, N> {
+    typedef BlockKernel<N> type;
+};
+
+template<class Kernels, int N>
+struct FillTable {
+    static void run(KernelTable& table) {
+        table.pack[N] = &WidthKernel<Kernels, N>::type::pack;
+        table.unpack[N] = &WidthKernel<Kernels, N>::type::unpack;
+        table.write[N] = &WidthKernel<Kernels, N>::type::write;
+        table.read[N] = &WidthKernel<Kernels, N>::type::read;
+        table.names[N] = Kernels::name();
+        FillTable<Kernels, N - 1>::run(table);
+    }
+};
+
+template<class Kernels>
+struct FillTable<Kernels, -1> {
+    static void run(KernelTable&) {
+    }
+};
+
+template<class Kernels>
+KernelTable make_kernel_table() {
+    KernelTable table;
+    FillTable<Kernels, 64>::run(table);
+    return table;
+}
+
+//! Table with every width implemented by `Kernels`
+template<class Kernels>
+const KernelTable& kernel_table() {
+    static const KernelTable table = make_kernel_table<Kernels>();
+    return table;
+}
+
+/** Pick the best implementation for each width. SIMD kernels have no
+  * vectorized tail wider than one bit, widths with a 2-7 bit tail are
+  * faster with the fused scalar kernel. With fast PDEP/PEXT the tail goes
+  * through BMI2 on top of the SIMD planes; this wins for every pack and
+  * for unpack of even tails (odd ones are still faster with scalar).
+  */
+inline KernelTable bind_kernels(const CpuFeatures& cpu) {
+    const KernelTable& scalar = kernel_table<ScalarKernels>();
+    const KernelTable* simd = &scalar;
+    const KernelTable* bmi2 = 0;
+    if (cpu.avx512f) {
+        simd = &kernel_table<Avx512Kernels>();
+        bmi2 = &kernel_table<Bmi2Kernels<Avx512Kernels> >();
+    } else if (cpu.avx2) {
+        simd = &kernel_table<Avx2Kernels>();
+        bmi2 = &kernel_table<Bmi2Kernels<Avx2Kernels> >();
+    } else if (cpu.sse41) {
+        simd = &kernel_table<Sse41Kernels>();
+        bmi2 = &kernel_table<Bmi2Kernels<Sse41Kernels> >();
+    }
+    if (!cpu.fast_pdep) {
+        bmi2 = 0;
+    }
+    KernelTable table;
+    for (int n = 0; n <= 64; n++) {
+        const KernelTable* pack = simd;
+        const KernelTable* unpack = simd;
+        if (n % 8 > 1) {
+            pack = bmi2 ? bmi2 : &scalar;
+            unpack = bmi2 && n % 2 == 0 ? bmi2 : &scalar;
+        }
+        table.pack[n] = pack->pack[n];
+        table.unpack[n] = unpack->unpack[n];
+        table.write[n] = pack->write[n];
+        table.read[n] = unpack->read[n];
+        table.names[n] = pack->names[n];
+    }
+    return table;
+}
+
+//! Kernels bound to the host CPU on first use
+inline const KernelTable& best_kernels() {
+    static const KernelTable table = bind_kernels(cpu_features());
+    return table;
+}
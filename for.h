@@ -0,0 +1,222 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+
+#include "bitpack.h"
+
+/** Frame-of-reference block codec.
+  * Every 16-value block is stored as a header (u8 width, u64 base) followed
+  * by the residuals `value - base` packed with the width kernels, where
+  * `base` is the block minimum and `width` is the bit width of the
+  * largest residual. Decode adds the base back inside the unpack loop.
+  */
+namespace frame {
+
+//! Policy of BlockKernel::decode, stores `value + base`
+struct AddBase {
+    u64* output;
+    u64 base;
+
+    AddBase(u64* output, u64 base)
+        : output(output)
+        , base(base)
+    {
+    }
+
+    void operator () (int i, u64 value) {
+        output[i] = value + base;
+    }
+};
+
+enum {
+    HEADER_SIZE = 9,
+    //! Width, base and exceptions layout
+    PFOR_HEADER_SIZE = 10,
+};
+
+typedef void (*UnpackFn)(const u8* input, u64* output, u64 base);
+
+template<int N>
+struct Kernel {
+    static void unpack(const u8* input, u64* output, u64 base) {
+        AddBase op(output, base);
+        BlockKernel<N>::decode(input, op);
+    }
+};
+
+template<int N>
+struct Fill {
+    static void run(UnpackFn* table) {
+        table[N] = &Kernel<N>::unpack;
+        Fill<N - 1>::run(table);
+    }
+};
+
+template<>
+struct Fill<-1> {
+    static void run(UnpackFn*) {
+    }
+};
+
+struct UnpackTable {
+    UnpackFn unpack[65];
+
+    UnpackTable() {
+        Fill<64>::run(unpack);
+    }
+};
+
+//! Fused decode kernels for widths 0-64
+inline const UnpackTable& unpack_table() {
+    static const UnpackTable table;
+    return table;
+}
+
+}  // namespace frame
+
+class ForEncoder {
+    MemoryStream &stream_;
+    const KernelTable& kernels_;
+public:
+    ForEncoder(MemoryStream& stream, const KernelTable& kernels = best_kernels())
+        : stream_(stream)
+        , kernels_(kernels)
+    {
+    }
+
+    //! Pack 16 values, returns false if the stream is full
+    bool pack(const u64* input) {
+        const u64 base = *std::min_element(input, input + 16);
+        u64 residuals[16];
+        u64 spread = 0;
+        for (int i = 0; i < 16; i++) {
+            residuals[i] = input[i] - base;
+            spread |= residuals[i];
+        }
+        const int n = get_bit_width(spread);
+        u8* header = stream_.allocate(frame::HEADER_SIZE);
+        if (!header) {
+            return false;
+        }
+        header[0] = static_cast<u8>(n);
+        std::memcpy(header + 1, &base, sizeof(base));
+        return kernels_.pack[n](stream_, residuals);
+    }
+
+    //! Unpack 16 values, output is overwritten
+    void unpack(u64* output) {
+        const u8* header = stream_.consume(frame::HEADER_SIZE);
+        const int n = header[0];
+        if (n > 64) {
+            throw std::out_of_range("Invalid bit width");
+        }
+        u64 base;
+        std::memcpy(&base, header + 1, sizeof(base));
+        frame::unpack_table().unpack[n](stream_.consume(2*n), output, base);
+    }
+};
+
+/** Patched FOR. Block width is chosen per block to minimize the encoded
+  * size, residuals that don't fit are stored as exceptions after the
+  * packed block: positions as 4-bit nibbles, then the bits above the
+  * width of every exception in `ceil((max_width - width)/8)` bytes.
+  * Header: u8 width, u64 base, u8 `bytes << 4 | count` of exceptions
+  * (all 16 values are never exceptions, the count fits in 4 bits).
+  */
+class PforEncoder {
+    MemoryStream &stream_;
+    const KernelTable& kernels_;
+
+    static int _exception_bytes(int width, int max_width) {
+        return (max_width - width + 7) / 8;
+    }
+public:
+    PforEncoder(MemoryStream& stream, const KernelTable& kernels = best_kernels())
+        : stream_(stream)
+        , kernels_(kernels)
+    {
+    }
+
+    //! Pack 16 values, returns false if the stream is full
+    bool pack(const u64* input) {
+        const u64 base = *std::min_element(input, input + 16);
+        u64 residuals[16];
+        int widths[16];
+        int hist[65] = {};
+        int max_width = 0;
+        for (int i = 0; i < 16; i++) {
+            residuals[i] = input[i] - base;
+            widths[i] = get_bit_width(residuals[i]);
+            hist[widths[i]]++;
+            max_width = std::max(max_width, widths[i]);
+        }
+        // cost of every width: packed block plus exceptions above it
+        int n = max_width;
+        int best = 2*max_width;
+        int above = 0;
+        for (int w = max_width - 1; w >= 0; w--) {
+            above += hist[w + 1];
+            const int cost = 2*w + (above + 1)/2 + above*_exception_bytes(w, max_width);
+            if (cost < best) {
+                best = cost;
+                n = w;
+            }
+        }
+        const int nbytes = _exception_bytes(n, max_width);
+        u8 positions[8] = {};
+        u64 high[16];
+        int count = 0;
+        for (int i = 0; i < 16; i++) {
+            if (widths[i] > n) {
+                positions[count / 2] |= static_cast<u8>(i << 4*(count % 2));
+                high[count++] = residuals[i] >> n;
+                residuals[i] &= n == 64 ? ~0ull : (1ull << n) - 1;
+            }
+        }
+        u8* header = stream_.allocate(frame::PFOR_HEADER_SIZE);
+        if (!header) {
+            return false;
+        }
+        header[0] = static_cast<u8>(n);
+        std::memcpy(header + 1, &base, sizeof(base));
+        header[9] = static_cast<u8>(nbytes << 4 | count);
+        if (!kernels_.pack[n](stream_, residuals)) {
+            return false;
+        }
+        if (count) {
+            u8* out = stream_.allocate((count + 1)/2 + count*nbytes);
+            if (!out) {
+                return false;
+            }
+            std::memcpy(out, positions, (count + 1)/2);
+            out += (count + 1)/2;
+            for (int i = 0; i < count; i++) {
+                std::memcpy(out + i*nbytes, &high[i], nbytes);
+            }
+        }
+        return true;
+    }
+
+    //! Unpack 16 values, output is overwritten
+    void unpack(u64* output) {
+        const u8* header = stream_.consume(frame::PFOR_HEADER_SIZE);
+        const int n = header[0];
+        const int count = header[9] & 0xF;
+        const int nbytes = header[9] >> 4;
+        if (n > 64 || nbytes > 8) {
+            throw std::out_of_range("Invalid block header");
+        }
+        u64 base;
+        std::memcpy(&base, header + 1, sizeof(base));
+        frame::unpack_table().unpack[n](stream_.consume(2*n), output, base);
+        if (count) {
+            const u8* positions = stream_.consume((count + 1)/2);
+            const u8* high = stream_.consume(count*nbytes);
+            for (int i = 0; i < count; i++) {
+                u64 bits = 0;
+                std::memcpy(&bits, high + i*nbytes, nbytes);
+                output[(positions[i / 2] >> 4*(i % 2)) & 0xF] += bits << n;
+            }
+        }
+    }
+};
@@ -1,1257 +1,1113 @@
 #include <iostream>
 #include <vector>
-#include <stdexcept>
-#include <random>
-#include <cstdint>
+#include <cstdlib>
 #include <algorithm>
+#include <iterator>
+#include <limits>
+#include <cmath>
 
-typedef std::uint64_t u64;
-typedef std::int64_t  i64;
-typedef std::uint32_t u32;
-typedef std::int32_t  i32;
-typedef std::uint16_t u16;
-typedef std::int16_t  i16;
-typedef unsigned char  u8;
+#include "bitpack.h"
+#include "workload.h"
+#include "vertical.h"
+#include "for.h"
+#include "delta.h"
+#include "adaptive.h"
+#include "parallel.h"
+#include "aggregate.h"
+#include "scan.h"
+#include "column.h"
+#include "rle.h"
+#include "parquet.h"
+#include "dict.h"
+#include "alp.h"
 
-struct RandomWalk {
-    u64 value;
-    u64 mask;
-
-    RandomWalk(u64 mask)
-        : mask(mask)
-    {
+//! Kernels should round-trip every width and emit the same bytes as the scalar ones
+bool check_kernels(const KernelTable& kernels) {
+    const int nblocks = 64;
+    for (int n = 0; n <= 64; n++) {
+        workload::Uniform gen(n == 64 ? ~0ull : (1ull << n) - 1);
+        std::vector<u64> expected;
+        for (int i = 0; i < 16*nblocks; i++) {
+            expected.push_back(gen.generate());
+        }
+        MemoryStream stream(128*nblocks);
+        MemoryStream refstream(128*nblocks);
+        Encoder encoder(stream, kernels);
+        Encoder reference(refstream, kernel_table<ScalarKernels>());
+        const std::vector<u64> original = expected;
+        for (int i = 0; i < 16*nblocks; i += 16) {
+            encoder.pack(expected.data() + i, n);
+            reference.pack(expected.data() + i, n);
+        }
+        if (expected != original) {
+            std::cout << "Kernel " << kernels.names[n] << " modified the input, width: " << n << std::endl;
+            return false;
+        }
+        if (stream.size() != refstream.size() ||
+            !std::equal(stream.data(), stream.data() + stream.size(), refstream.data())) {
+            std::cout << "Kernel " << kernels.names[n] << " mismatch, width: " << n << std::endl;
+            return false;
+        }
+        stream.reset();
+        for (int i = 0; i < 16*nblocks; i += 16) {
+            // unpack overwrites the output, garbage shouldn't leak through
+            u64 output[16];
+            std::fill(output, output + 16, 0xA5A5A5A5A5A5A5A5ull);
+            if (encoder.unpack(output, n) != STATUS_OK) {
+                std::cout << "Kernel " << kernels.names[n] << " unpack failed, width: " << n << std::endl;
+                return false;
+            }
+            for (int j = 0; j < 16; j++) {
+                if (output[j] != expected[i + j]) {
+                    std::cout << "Kernel " << kernels.names[n] << " error, width: " << std::dec << n
+                              << ", index: " << i + j << ", expected: " << std::hex << expected[i + j]
+                              << ", actual: " << output[j] << std::endl;
+                    return false;
+                }
+            }
+        }
     }
+    return true;
+}
 
-    u64 generate() {
-        value = static_cast<u64>(rand()) | (static_cast<u64>(rand()) << 32);
-        return value & mask;
+//! Truncated streams and bad widths are reported without exceptions
+bool check_status(const KernelTable& kernels) {
+    for (int n = 1; n <= 64; n++) {
+        MemoryStream stream(2*n - 1);
+        Encoder encoder(stream, kernels);
+        u64 output[16];
+        if (encoder.unpack(output, n) != STATUS_END_OF_STREAM || stream.size() != 0 ||
+            encoder.unpack(output, 65) != STATUS_INVALID_WIDTH ||
+            encoder.unpack(output, -1) != STATUS_INVALID_WIDTH) {
+            std::cout << "Kernel " << kernels.names[n] << " status error, width: " << n << std::endl;
+            return false;
+        }
     }
-};
+    return true;
+}
 
-class MemoryStream {
-    std::vector<u8> data_;
-    u8* pos_;
-    u8* end_;
-public:
+/** Every sink should receive the same bytes as MemoryStream, the
+  * external buffer stops when full, segments decode on their own.
+  */
+bool check_sinks() {
+    const int nblocks = 200;
+    const std::vector<u64> values = workload::generate(workload::RANDOM_WALK, 16*nblocks);
+    MemoryStream stream(128*nblocks);
+    GrowableSink growable(1);
+    SegmentedSink segmented(1000);
+    std::vector<u8> buffer(40*nblocks);
+    BufferSink external(buffer.data(), buffer.size());
+    Encoder encoder(stream);
+    BasicEncoder<GrowableSink> growable_encoder(growable);
+    BasicEncoder<SegmentedSink> segmented_encoder(segmented);
+    BasicEncoder<BufferSink> external_encoder(external);
+    size_t nexternal = 0;
+    for (int b = 0; b < nblocks; b++) {
+        const int n = 20 + b % 45;
+        encoder.pack(values.data() + 16*b, n);
+        growable_encoder.pack(values.data() + 16*b, n);
+        segmented_encoder.pack(values.data() + 16*b, n);
+        if (external_encoder.pack(values.data() + 16*b, n)) {
+            nexternal = stream.size();
+        }
+    }
+    std::vector<u8> joined(segmented.size());
+    segmented.copy_to(joined.data());
+    bool ok = growable.size() == stream.size() &&
+              std::equal(stream.data(), stream.data() + stream.size(), growable.data()) &&
+              joined.size() == stream.size() && std::equal(joined.begin(), joined.end(), stream.data()) &&
+              external.size() == nexternal && nexternal < stream.size() &&
+              std::equal(buffer.begin(), buffer.begin() + nexternal, stream.data()) &&
+              segmented.nsegments() > 1;
+    // blocks never straddle segments
+    for (size_t s = 0, b = 0; ok && s < segmented.nsegments(); s++) {
+        BufferSource source(segmented.segment_data(s), segmented.segment_size(s));
+        BasicEncoder<BufferSource> decoder(source);
+        for (; ok && source.size() < segmented.segment_size(s); b++) {
+            const int n = 20 + b % 45;
+            u64 output[16];
+            ok = decoder.unpack(output, n) == STATUS_OK;
+            for (int i = 0; ok && i < 16; i++) {
+                ok = output[i] == (values[16*b + i] & (n == 64 ? ~0ull : (1ull << n) - 1));
+            }
+        }
+    }
+    if (!ok) {
+        std::cout << "Sink error" << std::endl;
+    }
+    return ok;
+}
 
-    MemoryStream(size_t size)
-        : data_(size)
-        , pos_(data_.data())
-        , end_(data_.data() + size)
-    {
+//! Width-specialized entry points should match the kernel table
+template<int N>
+bool check_fixed_width() {
+    workload::Uniform gen(Mask<N>::value);
+    MemoryStream stream(128);
+    MemoryStream refstream(128);
+    Encoder encoder(stream);
+    Encoder reference(refstream);
+    u64 expected[16];
+    for (int i = 0; i < 16; i++) {
+        expected[i] = gen.generate();
     }
+    encoder.pack<N>(expected);
+    reference.pack(expected, N);
+    stream.reset();
+    u64 output[16];
+    std::fill(output, output + 16, ~0ull);
+    encoder.unpack<N>(output);
+    if (stream.size() != refstream.size() ||
+        !std::equal(stream.data(), stream.data() + stream.size(), refstream.data()) ||
+        !std::equal(output, output + 16, expected)) {
+        std::cout << "Fixed width kernel error, width: " << N << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    template <class TVal> bool put_raw(TVal value) {
-        if ((end_ - pos_) < static_cast<i32>(sizeof(TVal))) {
+//! Narrow integer arrays should round-trip and produce the u64 layout
+template<typename T>
+bool check_typed(const char* name) {
+    const int nblocks = 16;
+    for (int n = 0; n <= typed::Table<T>::MAX_WIDTH; n++) {
+        workload::Uniform gen(n == 64 ? ~0ull : (1ull << n) - 1, n);
+        MemoryStream stream(128*nblocks);
+        MemoryStream refstream(128*nblocks);
+        Encoder encoder(stream);
+        Encoder reference(refstream);
+        std::vector<T> expected(16*nblocks);
+        for (int i = 0; i < 16*nblocks; i += 16) {
+            u64 wide[16];
+            for (int j = 0; j < 16; j++) {
+                wide[j] = gen.generate();
+                expected[i + j] = static_cast<T>(wide[j]);
+            }
+            encoder.pack(expected.data() + i, n);
+            reference.pack(wide, n);
+        }
+        bool ok = stream.size() == refstream.size() &&
+                  std::equal(stream.data(), stream.data() + stream.size(), refstream.data());
+        stream.reset();
+        for (int i = 0; ok && i < 16*nblocks; i += 16) {
+            T output[16];
+            std::fill(output, output + 16, static_cast<T>(0x5A5A5A5A5A5A5A5Aull));
+            encoder.unpack(output, n);
+            ok = std::equal(output, output + 16, expected.data() + i);
+        }
+        if (!ok) {
+            std::cout << "Typed " << name << " kernel error, width: " << n << std::endl;
             return false;
         }
-        *reinterpret_cast<TVal*>(pos_) = value;
-        pos_ += sizeof(value);
-        return true;
     }
+    return true;
+}
 
-    template <class TVal> TVal read_raw() {
-        size_t sz = sizeof(TVal);
-        if ((end_ - pos_) < static_cast<i32>(sz)) {
-            throw std::out_of_range("End-Of-Stream");
+/** Round-trip every width through the vertical layout and compare
+  * results with the scalar Encoder. Packed bytes should match the
+  * scalar reference kernels.
+  */
+template<int LANES>
+bool check_vertical(const vertical::Kernels<LANES>& kernels) {
+    const int size = VerticalEncoder<LANES>::BLOCK_SIZE;
+    const int nblocks = 64;
+    for (int n = 0; n <= 64; n++) {
+        workload::Uniform gen(n == 64 ? ~0ull : (1ull << n) - 1);
+        std::vector<u64> expected;
+        for (int i = 0; i < size*nblocks; i++) {
+            expected.push_back(gen.generate());
+        }
+        MemoryStream stream(VerticalEncoder<LANES>::block_bytes(64)*nblocks);
+        MemoryStream refstream(VerticalEncoder<LANES>::block_bytes(64)*nblocks);
+        MemoryStream scalar(VerticalEncoder<LANES>::block_bytes(64)*nblocks);
+        VerticalEncoder<LANES> encoder(stream, kernels);
+        VerticalEncoder<LANES> reference(refstream, vertical::scalar_kernels<LANES>());
+        Encoder scalar_encoder(scalar);
+        for (int i = 0; i < size*nblocks; i += size) {
+            if (!encoder.pack(expected.data() + i, n) || !reference.pack(expected.data() + i, n)) {
+                std::cout << "Vertical " << kernels.name << " pack error, width: " << n << std::endl;
+                return false;
+            }
+            for (int j = 0; j < size; j += 16) {
+                scalar_encoder.pack(expected.data() + i + j, n);
+            }
+        }
+        if (stream.size() != refstream.size() ||
+            !std::equal(stream.data(), stream.data() + stream.size(), refstream.data())) {
+            std::cout << "Vertical " << kernels.name << " kernel mismatch, width: " << n << std::endl;
+            return false;
+        }
+        stream.reset();
+        scalar.reset();
+        for (int i = 0; i < size*nblocks; i += size) {
+            u64 output[size];
+            if (encoder.unpack(output, n) != STATUS_OK) {
+                std::cout << "Vertical " << kernels.name << " unpack error, width: " << n << std::endl;
+                return false;
+            }
+            for (int j = 0; j < size; j += 16) {
+                u64 actual[16];
+                scalar_encoder.unpack(actual, n);
+                for (int k = 0; k < 16; k++) {
+                    if (output[j + k] != actual[k] || actual[k] != expected[i + j + k]) {
+                        std::cout << "Vertical " << kernels.name << " error, width: " << std::dec << n
+                                  << ", index: " << i + j + k << ", expected: " << std::hex << expected[i + j + k]
+                                  << ", actual: " << output[j + k] << std::endl;
+                        return false;
+                    }
+                }
+            }
         }
-        auto out = *reinterpret_cast<const TVal*>(pos_);
-        pos_ += sz;
-        return out;
     }
-
-    void reset() {
-        pos_ = data_.data();
+    // bad widths and truncated streams are reported without exceptions
+    MemoryStream stream(VerticalEncoder<LANES>::block_bytes(64) - 1);
+    VerticalEncoder<LANES> encoder(stream, kernels);
+    u64 block[size] = {};
+    if (encoder.pack(block, 65) || encoder.pack(block, -1) || encoder.pack(block, 64) || stream.size() != 0
+        || encoder.unpack(block, 65) != STATUS_INVALID_WIDTH || encoder.unpack(block, -1) != STATUS_INVALID_WIDTH
+        || encoder.unpack(block, 64) != STATUS_END_OF_STREAM || stream.size() != 0) {
+        std::cout << "Vertical " << kernels.name << " width check error" << std::endl;
+        return false;
     }
-};
-
-class Encoder {
-    MemoryStream &stream_;
-public:
-    Encoder(MemoryStream& stream) : stream_(stream) {}
+    return true;
+}
 
-    template<typename T>
-    bool _packN(const u64* input) {
+/** FOR round-trip for every residual width around a large base, width
+  * 0 (constant block) and full 64-bit spread included. Blocks should
+  * take the residual width, not the width of the values.
+  */
+bool check_for() {
+    for (int n = 0; n <= 64; n++) {
+        workload::Uniform gen(n == 64 ? ~0ull : (1ull << n) - 1);
+        const u64 base = n == 64 ? 0 : (1ull << 40) + 12345;
+        MemoryStream stream(frame::HEADER_SIZE + 128);
+        ForEncoder encoder(stream);
+        u64 input[16];
         for (int i = 0; i < 16; i++) {
-            T bits = static_cast<T>(input[i]);
-            if (!stream_.put_raw(bits)) {
+            input[i] = base + gen.generate();
+        }
+        // pin the spread to exactly n bits
+        input[3] = base;
+        input[7] = base + (n == 64 ? ~0ull : (1ull << n) - 1);
+        if (!encoder.pack(input) || stream.size() != frame::HEADER_SIZE + 2*static_cast<size_t>(n)) {
+            std::cout << "FOR pack error, width: " << n << std::endl;
+            return false;
+        }
+        stream.reset();
+        u64 output[16];
+        encoder.unpack(output);
+        if (!std::equal(output, output + 16, input)) {
+            std::cout << "FOR unpack error, width: " << n << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/** PFOR round-trip on blocks with 0-15 outliers of every width over a
+  * small spread. A single outlier should not widen the block.
+  */
+bool check_pfor() {
+    for (int outliers = 0; outliers < 16; outliers++) {
+        for (int n = 0; n <= 64; n++) {
+            workload::Uniform gen(0x3F);
+            workload::Uniform wide(n == 64 ? ~0ull : (1ull << n) - 1, n);
+            const u64 base = 1ull << 40;
+            MemoryStream stream(frame::PFOR_HEADER_SIZE + 256);
+            PforEncoder encoder(stream);
+            u64 input[16];
+            for (int i = 0; i < 16; i++) {
+                input[i] = base + gen.generate();
+            }
+            for (int i = 0; i < outliers; i++) {
+                input[(i*7) % 16] += wide.generate();
+            }
+            if (!encoder.pack(input)) {
+                std::cout << "PFOR pack error, width: " << n << std::endl;
+                return false;
+            }
+            if (outliers == 1 && n > 16 && stream.size() > frame::PFOR_HEADER_SIZE + 2*6 + 1 + 8) {
+                std::cout << "PFOR size error, width: " << n << ", size: " << stream.size() << std::endl;
+                return false;
+            }
+            stream.reset();
+            u64 output[16];
+            encoder.unpack(output);
+            if (!std::equal(output, output + 16, input)) {
+                std::cout << "PFOR unpack error, width: " << n << ", outliers: " << outliers << std::endl;
                 return false;
             }
         }
-        return true;
     }
+    return true;
+}
 
-    template <typename T>
-    void _unpackN(u64* input, int shift) {
-        for (int i = 0; i < 16; i++) {
-            T val = static_cast<T>(stream_.read_raw<T>());
-            input[i] |= static_cast<u64>(val) << shift;
+/** Delta round-trip on timestamps with jitter, a random walk, sorted
+  * runs, constant and random blocks. Regular series should use the
+  * delta-of-delta mode and fit into a few bits.
+  */
+bool check_delta(const delta::PrefixSumKernels& prefix) {
+    const int nblocks = 64;
+    workload::Timestamps timestamps(1500000000000ull, 1000, 4);
+    std::vector<u64> series = workload::generate(timestamps, 16*nblocks);
+    const size_t regular = series.size();
+    workload::RandomWalk walk(1ull << 40, 100);
+    workload::SortedRuns runs(100, 16, ~0ull);
+    workload::Uniform gen(~0ull);
+    for (int i = 0; i < 16*nblocks; i++) {
+        series.push_back(walk.generate());
+    }
+    for (int i = 0; i < 16*nblocks; i++) {
+        series.push_back(runs.generate());
+    }
+    series.insert(series.end(), 16, 42);
+    for (int i = 0; i < 16*nblocks; i++) {
+        series.push_back(gen.generate());
+    }
+    MemoryStream stream(17*series.size());
+    DeltaEncoder encoder(stream, best_kernels(), prefix);
+    for (size_t i = 0; i < series.size(); i += 16) {
+        if (!encoder.pack(series.data() + i)) {
+            std::cout << "Delta pack error, index: " << i << std::endl;
+            return false;
+        }
+        if (i + 16 == regular && stream.size() > 32*regular/16) {
+            std::cout << "Delta " << prefix.name << " size error: " << stream.size() << std::endl;
+            return false;
         }
     }
+    stream.reset();
+    for (size_t i = 0; i < series.size(); i += 16) {
+        u64 output[16];
+        encoder.unpack(output);
+        if (!std::equal(output, output + 16, series.data() + i)) {
+            std::cout << "Delta " << prefix.name << " error, index: " << i << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
 
-    bool _pack1(const u64* input) {
-        u16 bits = 0;
+/** Adaptive stream round-trip, value range drifts from block to block
+  * (all widths, incomplete last group). Every block should take
+  * exactly its own width.
+  */
+bool check_adaptive() {
+    const int nblocks = 3*65 + 3;
+    std::vector<u64> expected;
+    size_t payload = 0;
+    for (int b = 0; b < nblocks; b++) {
+        const int n = b % 65;
+        workload::Uniform gen(n == 64 ? ~0ull : (1ull << n) - 1);
         for (int i = 0; i < 16; i++) {
-            bits |= static_cast<u16>((input[i] & 1) << i);
+            expected.push_back(gen.generate());
         }
-        if (!stream_.put_raw(bits)) {
+        expected.back() |= n == 0 ? 0 : 1ull << (n - 1);
+        payload += 2*n;
+    }
+    MemoryStream stream(AdaptiveEncoder::max_size(nblocks));
+    AdaptiveEncoder encoder(stream);
+    for (int b = 0; b < nblocks; b++) {
+        if (!encoder.pack(expected.data() + 16*b)) {
+            std::cout << "Adaptive pack error, block: " << b << std::endl;
             return false;
         }
-        return true;
     }
-
-    void _unpack1(u64* output, int shift) {
-        u16 bits = stream_.read_raw<u16>();
-        for (int i = 0; i < 16; i++) {
-            output[i] |= static_cast<u64>((bits & (1 << i)) >> i) << shift;
+    const size_t groups = (nblocks + AdaptiveEncoder::GROUP_SIZE - 1) / AdaptiveEncoder::GROUP_SIZE;
+    if (stream.size() != payload + groups*AdaptiveEncoder::GROUP_SIZE) {
+        std::cout << "Adaptive size error: " << stream.size() << std::endl;
+        return false;
+    }
+    encoder.rewind();
+    for (int b = 0; b < nblocks; b++) {
+        u64 output[16];
+        encoder.unpack(output);
+        if (!std::equal(output, output + 16, expected.data() + 16*b)) {
+            std::cout << "Adaptive unpack error, block: " << b << std::endl;
+            return false;
         }
     }
+    return true;
+}
 
-    bool _pack2(const u64* input) {
-        u32 bits = 0;
+/** Random access through the block index should match the input for
+  * single values and ranges crossing block, group and index boundaries.
+  */
+bool check_index(int stride, const KernelTable& kernels) {
+    const int nblocks = 1000;
+    std::vector<u64> expected;
+    for (int b = 0; b < nblocks; b++) {
+        workload::Uniform gen((b * 7) % 65 == 64 ? ~0ull : (1ull << ((b * 7) % 65)) - 1);
         for (int i = 0; i < 16; i++) {
-            bits |= static_cast<u32>((input[i] & 3) << 2*i);
+            expected.push_back(gen.generate());
         }
-        if (!stream_.put_raw(bits)) {
+    }
+    MemoryStream stream(AdaptiveEncoder::max_size(nblocks));
+    BlockIndex index(stride);
+    AdaptiveEncoder encoder(stream, best_kernels(), &index);
+    // last block is partial, its padding shouldn't be readable
+    const size_t count = 16*nblocks - 7;
+    for (int b = 0; b < nblocks; b++) {
+        encoder.pack(expected.data() + 16*b, static_cast<int>(std::min<size_t>(16, count - 16*b)));
+    }
+    expected.resize(count);
+    AdaptiveReader reader(stream.data(), stream.size(), index, kernels);
+    if (reader.size() != expected.size()) {
+        std::cout << "Index size error: " << reader.size() << std::endl;
+        return false;
+    }
+    try {
+        reader.get(count);
+        std::cout << "Index padding error, stride: " << stride << std::endl;
+        return false;
+    } catch (const std::out_of_range&) {
+    }
+    for (size_t i = 0; i < expected.size(); i += 37) {
+        if (reader.get(i) != expected[i]) {
+            std::cout << "Index get error, stride: " << stride << ", index: " << i << std::endl;
             return false;
         }
-        return true;
     }
-
-    void _unpack2(u64* output, int shift) {
-        u32 bits = stream_.read_raw<u32>();
-        for (u32 i = 0; i < 16; i++) {
-            output[i] |= static_cast<u64>((bits & (3u << 2*i)) >> 2*i) << shift;
+    const size_t ranges[][2] = {{0, 0}, {0, count}, {5, 6}, {15, 17}, {100, 3000}, {2047, 2049}, {count - 1, count}};
+    for (size_t r = 0; r < sizeof(ranges)/sizeof(ranges[0]); r++) {
+        std::vector<u64> output(ranges[r][1] - ranges[r][0]);
+        reader.decode_range(ranges[r][0], ranges[r][1], output.data());
+        if (!std::equal(output.begin(), output.end(), expected.begin() + ranges[r][0])) {
+            std::cout << "Index range error, stride: " << stride << ", range: " << ranges[r][0] << std::endl;
+            return false;
         }
     }
+    // truncated stream, reads past the end should throw
+    AdaptiveReader truncated(stream.data(), stream.size() / 2, index);
+    std::vector<u64> output(expected.size());
+    try {
+        truncated.get(expected.size() - 1);
+        std::cout << "Index truncated get error, stride: " << stride << std::endl;
+        return false;
+    } catch (const std::out_of_range&) {
+    }
+    try {
+        truncated.decode_range(0, expected.size(), output.data());
+        std::cout << "Index truncated range error, stride: " << stride << std::endl;
+        return false;
+    } catch (const std::out_of_range&) {
+    }
+    return true;
+}
 
-    bool _pack3(const u64* input) {
-        u32 bits0 = 0;
-        u16 bits1 = 0;
-        bits0 |= static_cast<u32>((input[0]  & 7));
-        bits0 |= static_cast<u32>((input[1]  & 7) << 3);
-        bits0 |= static_cast<u32>((input[2]  & 7) << 6);
-        bits0 |= static_cast<u32>((input[3]  & 7) << 9);
-        bits0 |= static_cast<u32>((input[4]  & 7) << 12);
-        bits0 |= static_cast<u32>((input[5]  & 7) << 15);
-        bits0 |= static_cast<u32>((input[6]  & 7) << 18);
-        bits0 |= static_cast<u32>((input[7]  & 7) << 21);
-        bits0 |= static_cast<u32>((input[8]  & 7) << 24);
-        bits0 |= static_cast<u32>((input[9]  & 7) << 27);
-        bits0 |= static_cast<u32>((input[10] & 3) << 30);
-        bits1 |= static_cast<u32>((input[10] & 4) >> 2);
-        bits1 |= static_cast<u32>((input[11] & 7) << 1);
-        bits1 |= static_cast<u32>((input[12] & 7) << 4);
-        bits1 |= static_cast<u32>((input[13] & 7) << 7);
-        bits1 |= static_cast<u32>((input[14] & 7) << 10);
-        bits1 |= static_cast<u32>((input[15] & 7) << 13);
-        if (!stream_.put_raw(bits0)) {
+/** Cursor over an adaptive stream with a partial last block: mixed
+  * next/next_batch/skip steps should follow the input, skips crossing
+  * block and group boundaries and running past the end included.
+  */
+bool check_cursor(const KernelTable& kernels) {
+    const size_t count = 16*300 + 9;
+    std::vector<u64> expected(count);
+    for (size_t i = 0; i < count; i++) {
+        const int n = static_cast<int>((i / 16 * 11) % 65);
+        expected[i] = workload::Uniform(n == 64 ? ~0ull : (1ull << n) - 1, i).generate();
+    }
+    MemoryStream stream(AdaptiveEncoder::max_size(count/16 + 1));
+    AdaptiveEncoder encoder(stream);
+    for (size_t i = 0; i < count; i += 16) {
+        u64 block[16] = {};
+        std::copy(expected.begin() + i, expected.begin() + std::min(count, i + 16), block);
+        encoder.pack(block);
+    }
+    AdaptiveCursor cursor(stream.data(), stream.size(), count, kernels);
+    const size_t steps[] = {0, 1, 3, 15, 16, 17, 31, 100, 129, 1000};
+    size_t pos = 0;
+    for (size_t s = 0; pos < count; s++) {
+        const size_t n = steps[s % 10];
+        u64 output[1000];
+        size_t got = n;
+        switch (s % 4) {
+        case 0:
+            if (cursor.next() != expected[pos]) {
+                got = count;
+            } else {
+                got = 1;
+            }
+            break;
+        case 1:
+            got = cursor.next_batch(output, n);
+            if (!std::equal(output, output + got, expected.begin() + pos)) {
+                got = count;
+            }
+            break;
+        default:
+            // two skips in a row, the second one starts inside a block that wasn't decoded
+            got = static_cast<size_t>(cursor.skip(n));
+            break;
+        }
+        if (got != std::min(s % 4 == 0 ? 1 : n, count - pos)) {
+            std::cout << "Cursor error, step: " << s << ", position: " << pos << std::endl;
             return false;
         }
-        if (!stream_.put_raw(bits1)) {
+        pos += got;
+        if (cursor.remaining() != count - pos) {
+            std::cout << "Cursor remaining error, step: " << s << std::endl;
             return false;
         }
-        return true;
     }
-
-    void _unpack3(u64* output, int shift) {
-        u32 bits0  = stream_.read_raw<u32>();
-        u16 bits1  = stream_.read_raw<u16>();
-        output[0]  |= ((bits0 & 7)) << shift;
-        output[1]  |= ((bits0 & (7u <<  3)) >> 3)  << shift;
-        output[2]  |= ((bits0 & (7u <<  6)) >> 6)  << shift;
-        output[3]  |= ((bits0 & (7u <<  9)) >> 9)  << shift;
-        output[4]  |= ((bits0 & (7u << 12)) >> 12) << shift;
-        output[5]  |= ((bits0 & (7u << 15)) >> 15) << shift;
-        output[6]  |= ((bits0 & (7u << 18)) >> 18) << shift;
-        output[7]  |= ((bits0 & (7u << 21)) >> 21) << shift;
-        output[8]  |= ((bits0 & (7u << 24)) >> 24) << shift;
-        output[9]  |= ((bits0 & (7u << 27)) >> 27) << shift;
-        output[10] |= (((bits0 & (3u << 30)) >> 30) | ((bits1 & 1u) << 2)) << shift;
-        output[11] |= ((bits1 & (7u <<  1)) >> 1)  << shift;
-        output[12] |= ((bits1 & (7u <<  4)) >> 4)  << shift;
-        output[13] |= ((bits1 & (7u <<  7)) >> 7)  << shift;
-        output[14] |= ((bits1 & (7u << 10)) >> 10) << shift;
-        output[15] |= ((bits1 & (7u << 13)) >> 13) << shift;
+    u64 output[16];
+    if (cursor.next_batch(output, 16) != 0 || cursor.skip(16) != 0) {
+        std::cout << "Cursor end error" << std::endl;
+        return false;
+    }
+    try {
+        cursor.next();
+        std::cout << "Cursor end error" << std::endl;
+        return false;
+    } catch (const std::out_of_range&) {
     }
+    return true;
+}
 
-    bool _pack4(const u64* input) {
-        u64 bits0 = 0;
-        bits0 |= static_cast<u64>((input[0]  & 0xF));
-        bits0 |= static_cast<u64>((input[1]  & 0xF) << 4);
-        bits0 |= static_cast<u64>((input[2]  & 0xF) << 8);
-        bits0 |= static_cast<u64>((input[3]  & 0xF) << 12);
-        bits0 |= static_cast<u64>((input[4]  & 0xF) << 16);
-        bits0 |= static_cast<u64>((input[5]  & 0xF) << 20);
-        bits0 |= static_cast<u64>((input[6]  & 0xF) << 24);
-        bits0 |= static_cast<u64>((input[7]  & 0xF) << 28);
-        bits0 |= static_cast<u64>((input[8]  & 0xF) << 32);
-        bits0 |= static_cast<u64>((input[9]  & 0xF) << 36);
-        bits0 |= static_cast<u64>((input[10] & 0xF) << 40);
-        bits0 |= static_cast<u64>((input[11] & 0xF) << 44);
-        bits0 |= static_cast<u64>((input[12] & 0xF) << 48);
-        bits0 |= static_cast<u64>((input[13] & 0xF) << 52);
-        bits0 |= static_cast<u64>((input[14] & 0xF) << 56);
-        bits0 |= static_cast<u64>((input[15] & 0xF) << 60);
-        if (!stream_.put_raw(bits0)) {
+/** RLE hybrid round-trip: runs of every length around MIN_RUN, runs at
+  * the start and the end, literal stretches of every length and wide
+  * values. Long runs should shrink the stream.
+  */
+bool check_rle() {
+    workload::Rng rng(workload::DEFAULT_SEED);
+    std::vector<u64> values;
+    for (int r = 0; r < 400; r++) {
+        const u64 value = r % 5 == 0 ? ~0ull - r : rng.below(1ull << (r % 64));
+        const size_t length = r % 3 == 0 ? 1 + rng.below(8) : r % 40 + 1;
+        values.insert(values.end(), length, value);
+    }
+    const size_t tails[] = {0, 1, 15, 16, 17, 100};
+    for (size_t t = 0; t < sizeof(tails)/sizeof(tails[0]); t++) {
+        std::vector<u64> expected(values);
+        for (size_t i = 0; i < tails[t]; i++) {
+            expected.push_back(rng.next());
+        }
+        MemoryStream stream(RleEncoder::max_size(expected.size()));
+        RleEncoder encoder(stream);
+        if (!encoder.pack(expected.data(), expected.size())) {
+            std::cout << "RLE pack error, tail: " << tails[t] << std::endl;
+            return false;
+        }
+        const size_t size = stream.size();
+        stream.reset();
+        std::vector<u64> output(expected.size() + 1, 0xDEADull);
+        encoder.unpack(output.data(), expected.size());
+        if (!std::equal(expected.begin(), expected.end(), output.begin()) || output.back() != 0xDEADull
+            || stream.size() != size) {
+            std::cout << "RLE unpack error, tail: " << tails[t] << std::endl;
             return false;
         }
-        return true;
     }
-
-    void _unpack4(u64* output, int shift) {
-        u64 bits0  = stream_.read_raw<u64>();
-        output[0]  |= ((bits0 & 0xF)) << shift;
-        output[1]  |= ((bits0 & (15ull <<  4)) >>  4)  << shift;
-        output[2]  |= ((bits0 & (15ull <<  8)) >>  8)  << shift;
-        output[3]  |= ((bits0 & (15ull << 12)) >> 12)  << shift;
-        output[4]  |= ((bits0 & (15ull << 16)) >> 16)  << shift;
-        output[5]  |= ((bits0 & (15ull << 20)) >> 20)  << shift;
-        output[6]  |= ((bits0 & (15ull << 24)) >> 24)  << shift;
-        output[7]  |= ((bits0 & (15ull << 28)) >> 28)  << shift;
-        output[8]  |= ((bits0 & (15ull << 32)) >> 32)  << shift;
-        output[9]  |= ((bits0 & (15ull << 36)) >> 36)  << shift;
-        output[10] |= ((bits0 & (15ull << 40)) >> 40)  << shift;
-        output[11] |= ((bits0 & (15ull << 44)) >> 44)  << shift;
-        output[12] |= ((bits0 & (15ull << 48)) >> 48)  << shift;
-        output[13] |= ((bits0 & (15ull << 52)) >> 52)  << shift;
-        output[14] |= ((bits0 & (15ull << 56)) >> 56)  << shift;
-        output[15] |= ((bits0 & (15ull << 60)) >> 60)  << shift;
+    MemoryStream stream(RleEncoder::max_size(4096));
+    RleEncoder encoder(stream);
+    const std::vector<u64> flags(4096, 3);
+    encoder.pack(flags.data(), flags.size());
+    if (stream.size() > 4) {
+        std::cout << "RLE size error: " << stream.size() << std::endl;
+        return false;
     }
+    return true;
+}
 
-    bool _pack5(const u64* input) {
-        u64 bits0 = 0;
-        u16 bits1 = 0;
-        bits0 |= static_cast<u64>((input[0]  & 0x1F));
-        bits0 |= static_cast<u64>((input[1]  & 0x1F) << 5);
-        bits0 |= static_cast<u64>((input[2]  & 0x1F) << 10);
-        bits0 |= static_cast<u64>((input[3]  & 0x1F) << 15);
-        bits0 |= static_cast<u64>((input[4]  & 0x1F) << 20);
-        bits0 |= static_cast<u64>((input[5]  & 0x1F) << 25);
-        bits0 |= static_cast<u64>((input[6]  & 0x1F) << 30);
-        bits0 |= static_cast<u64>((input[7]  & 0x1F) << 35);
-        bits0 |= static_cast<u64>((input[8]  & 0x1F) << 40);
-        bits0 |= static_cast<u64>((input[9]  & 0x1F) << 45);
-        bits0 |= static_cast<u64>((input[10] & 0x1F) << 50);
-        bits0 |= static_cast<u64>((input[11] & 0x1F) << 55);
-        bits0 |= static_cast<u64>((input[12] & 0x0F) << 60);
-        bits1 |= static_cast<u32>((input[12] & 0x10) >> 4);
-        bits1 |= static_cast<u32>((input[13] & 0x1F) << 1);
-        bits1 |= static_cast<u32>((input[14] & 0x1F) << 6);
-        bits1 |= static_cast<u32>((input[15] & 0x1F) << 11);
-        if (!stream_.put_raw(bits0)) {
+/** Parquet hybrid: byte layout of the format spec examples, round-trip
+  * of every width with runs and uneven batches, width 1 levels decoded
+  * into a validity bitmap at an unaligned offset, and spaced values.
+  */
+bool check_parquet() {
+    {
+        // bit-packed 0-7 at width 3 and a run of 100 fives, from the spec
+        const u32 values[] = {0, 1, 2, 3, 4, 5, 6, 7};
+        const u8 expected[] = {0x03, 0x88, 0xC6, 0xFA, 0xC8, 0x01, 0x05};
+        std::vector<u32> input(values, values + 8);
+        input.insert(input.end(), 100, 5);
+        GrowableSink sink;
+        BasicParquetEncoder<GrowableSink> encoder(sink, 3);
+        encoder.encode(input.data(), input.size());
+        if (sink.size() != sizeof(expected) || !std::equal(expected, expected + sizeof(expected), sink.data())) {
+            std::cout << "Parquet layout error" << std::endl;
             return false;
         }
-        if (!stream_.put_raw(bits1)) {
+    }
+    workload::Rng rng(workload::DEFAULT_SEED);
+    for (int n = 0; n <= 64; n++) {
+        const u64 mask = n == 64 ? ~0ull : (1ull << n) - 1;
+        std::vector<u64> expected;
+        for (int r = 0; r < 200; r++) {
+            const u64 value = rng.next() & mask;
+            expected.insert(expected.end(), r % 4 == 0 ? 1 + rng.below(30) : 1, value);
+        }
+        MemoryStream stream(ParquetEncoder::max_size(expected.size(), n));
+        ParquetEncoder encoder(stream, n);
+        if (!encoder.encode(expected.data(), expected.size())) {
+            std::cout << "Parquet encode error, width: " << n << std::endl;
+            return false;
+        }
+        ParquetDecoder decoder(stream.data(), stream.size(), n);
+        std::vector<u64> output(expected.size() + 8);
+        size_t done = 0;
+        for (size_t batch = 1; done < expected.size(); batch = batch * 3 % 29 + 1) {
+            done += decoder.decode(output.data() + done, std::min(batch, expected.size() - done));
+        }
+        // decoding past the end yields the padding of the last group only
+        const size_t padding = decoder.decode(output.data() + done, 8);
+        if (!std::equal(expected.begin(), expected.end(), output.begin()) || padding >= 8) {
+            std::cout << "Parquet decode error, width: " << n << std::endl;
             return false;
         }
-        return true;
+        if (n <= 32) {
+            std::vector<u32> narrow(expected.begin(), expected.end());
+            std::vector<u32> decoded(narrow.size());
+            ParquetDecoder decoder32(stream.data(), stream.size(), n);
+            if (decoder32.decode(decoded.data(), decoded.size()) != decoded.size() || decoded != narrow) {
+                std::cout << "Parquet u32 decode error, width: " << n << std::endl;
+                return false;
+            }
+        }
     }
-
-    void _unpack5(u64* output, int shift) {
-        u64 bits0  = stream_.read_raw<u64>();
-        u64 bits1  = stream_.read_raw<u16>();
-        output[0]  |= ((bits0 & 0x1F)) << shift;
-        output[1]  |= ((bits0 & (0x1Full <<  5)) >>  5) << shift;
-        output[2]  |= ((bits0 & (0x1Full << 10)) >> 10) << shift;
-        output[3]  |= ((bits0 & (0x1Full << 15)) >> 15) << shift;
-        output[4]  |= ((bits0 & (0x1Full << 20)) >> 20) << shift;
-        output[5]  |= ((bits0 & (0x1Full << 25)) >> 25) << shift;
-        output[6]  |= ((bits0 & (0x1Full << 30)) >> 30) << shift;
-        output[7]  |= ((bits0 & (0x1Full << 35)) >> 35) << shift;
-        output[8]  |= ((bits0 & (0x1Full << 40)) >> 40) << shift;
-        output[9]  |= ((bits0 & (0x1Full << 45)) >> 45) << shift;
-        output[10] |= ((bits0 & (0x1Full << 50)) >> 50) << shift;
-        output[11] |= ((bits0 & (0x1Full << 55)) >> 55) << shift;
-        output[12] |= (((bits0 & (0x0Full << 60)) >> 60) | ((bits1 & 1) << 4)) << shift;
-        output[13] |= ((bits1 & (0x1Full <<  1)) >>  1) << shift;
-        output[14] |= ((bits1 & (0x1Full <<  6)) >>  6) << shift;
-        output[15] |= ((bits1 & (0x1Full << 11)) >> 11) << shift;
+    std::vector<u8> levels;
+    for (int r = 0; r < 300; r++) {
+        levels.insert(levels.end(), r % 3 == 0 ? rng.below(40) : 1, static_cast<u8>(rng.next() & 1));
     }
-
-    bool _pack6(const u64* input) {
-        u64 bits0 = 0;
-        u32 bits1 = 0;
-        bits0 |= static_cast<u64>((input[0]  & 0x3F));
-        bits0 |= static_cast<u64>((input[1]  & 0x3F) << 6);
-        bits0 |= static_cast<u64>((input[2]  & 0x3F) << 12);
-        bits0 |= static_cast<u64>((input[3]  & 0x3F) << 18);
-        bits0 |= static_cast<u64>((input[4]  & 0x3F) << 24);
-        bits0 |= static_cast<u64>((input[5]  & 0x3F) << 30);
-        bits0 |= static_cast<u64>((input[6]  & 0x3F) << 36);
-        bits0 |= static_cast<u64>((input[7]  & 0x3F) << 42);
-        bits0 |= static_cast<u64>((input[8]  & 0x3F) << 48);
-        bits0 |= static_cast<u64>((input[9]  & 0x3F) << 54);
-        bits0 |= static_cast<u64>((input[10] & 0x0F) << 60);
-        bits1 |= static_cast<u32>((input[10] & 0x30) >> 4);
-        bits1 |= static_cast<u32>((input[11] & 0x3F) << 2);
-        bits1 |= static_cast<u32>((input[12] & 0x3F) << 8);
-        bits1 |= static_cast<u32>((input[13] & 0x3F) << 14);
-        bits1 |= static_cast<u32>((input[14] & 0x3F) << 20);
-        bits1 |= static_cast<u32>((input[15] & 0x3F) << 26);
-        if (!stream_.put_raw(bits0)) {
+    MemoryStream stream(ParquetEncoder::max_size(levels.size(), 1));
+    ParquetEncoder encoder(stream, 1);
+    encoder.encode(levels.data(), levels.size());
+    const u64 offset = 3;
+    std::vector<u8> bitmap((offset + levels.size() + 7) / 8 + 1, 0xA5);
+    ParquetDecoder decoder(stream.data(), stream.size(), 1);
+    u64 nvalid = 0;
+    size_t done = 0;
+    for (size_t batch = 5; done < levels.size(); batch = batch * 7 % 97 + 1) {
+        done += decoder.decode_validity(bitmap.data(), offset + done, std::min(batch, levels.size() - done), &nvalid);
+    }
+    u64 expected_valid = 0;
+    for (size_t i = 0; i < levels.size(); i++) {
+        expected_valid += levels[i];
+        if (((bitmap[(offset + i) / 8] >> (offset + i) % 8) & 1) != levels[i]) {
+            std::cout << "Parquet validity error, level: " << i << std::endl;
             return false;
         }
-        if (!stream_.put_raw(bits1)) {
+    }
+    if (nvalid != expected_valid || (bitmap[0] & 7) != 5) {
+        std::cout << "Parquet validity count error: " << nvalid << std::endl;
+        return false;
+    }
+    std::vector<u32> values(nvalid);
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = static_cast<u32>(rng.below(1000));
+    }
+    MemoryStream value_stream(ParquetEncoder::max_size(values.size(), 10));
+    ParquetEncoder value_encoder(value_stream, 10);
+    value_encoder.encode(values.data(), values.size());
+    ParquetDecoder value_decoder(value_stream.data(), value_stream.size(), 10);
+    std::vector<u32> spaced(levels.size(), 0xDEAD);
+    if (value_decoder.decode_spaced(spaced.data(), spaced.size(), bitmap.data(), offset) != nvalid) {
+        std::cout << "Parquet spaced count error" << std::endl;
+        return false;
+    }
+    for (size_t i = 0, j = 0; i < levels.size(); i++) {
+        if (spaced[i] != (levels[i] ? values[j++] : 0)) {
+            std::cout << "Parquet spaced error, slot: " << i << std::endl;
             return false;
         }
-        return true;
-    }
-
-    void _unpack6(u64* output, int shift) {
-        u64 bits0  = stream_.read_raw<u64>();
-        u64 bits1  = stream_.read_raw<u32>();
-        output[0]  |= ((bits0 & 0x3F)) << shift;
-        output[1]  |= ((bits0 & (0x3Full <<  6)) >>  6) << shift;
-        output[2]  |= ((bits0 & (0x3Full << 12)) >> 12) << shift;
-        output[3]  |= ((bits0 & (0x3Full << 18)) >> 18) << shift;
-        output[4]  |= ((bits0 & (0x3Full << 24)) >> 24) << shift;
-        output[5]  |= ((bits0 & (0x3Full << 30)) >> 30) << shift;
-        output[6]  |= ((bits0 & (0x3Full << 36)) >> 36) << shift;
-        output[7]  |= ((bits0 & (0x3Full << 42)) >> 42) << shift;
-        output[8]  |= ((bits0 & (0x3Full << 48)) >> 48) << shift;
-        output[9]  |= ((bits0 & (0x3Full << 54)) >> 54) << shift;
-        output[10] |= (((bits0 & (0xFull << 60)) >> 60) | (bits1 & 0x3) << 2) << shift;
-        output[11] |= ((bits1 & (0x3Full <<  2)) >>  2) << shift;
-        output[12] |= ((bits1 & (0x3Full <<  8)) >>  8) << shift;
-        output[13] |= ((bits1 & (0x3Full << 14)) >> 14) << shift;
-        output[14] |= ((bits1 & (0x3Full << 20)) >> 20) << shift;
-        output[15] |= ((bits1 & (0x3Full << 26)) >> 26) << shift;
     }
+    return true;
+}
 
-    bool _pack7(const u64* input) {
-        u64 bits0 = 0;
-        u32 bits1 = 0;
-        u16 bits2 = 0;
-        bits0 |= static_cast<u64>((input[0]  & 0x7F));
-        bits0 |= static_cast<u64>((input[1]  & 0x7F) << 7);
-        bits0 |= static_cast<u64>((input[2]  & 0x7F) << 14);
-        bits0 |= static_cast<u64>((input[3]  & 0x7F) << 21);
-        bits0 |= static_cast<u64>((input[4]  & 0x7F) << 28);
-        bits0 |= static_cast<u64>((input[5]  & 0x7F) << 35);
-        bits0 |= static_cast<u64>((input[6]  & 0x7F) << 42);
-        bits0 |= static_cast<u64>((input[7]  & 0x7F) << 49);
-        bits0 |= static_cast<u64>((input[8]  & 0x7F) << 56);
-        bits0 |= static_cast<u64>((input[9]  & 0x01) << 63);
-        bits1 |= static_cast<u32>((input[9]  & 0x7E) >> 1);
-        bits1 |= static_cast<u32>((input[10] & 0x7F) << 6);
-        bits1 |= static_cast<u32>((input[11] & 0x7F) << 13);
-        bits1 |= static_cast<u32>((input[12] & 0x7F) << 20);
-        bits1 |= static_cast<u32>((input[13] & 0x1F) << 27);
-        bits2 |= static_cast<u16>((input[13] & 0x60) >> 5);
-        bits2 |= static_cast<u16>((input[14] & 0x7F) << 2);
-        bits2 |= static_cast<u16>((input[15] & 0x7F) << 9);
-        if (!stream_.put_raw(bits0)) {
+/** Dictionary codec: hash table lookups, codes in value order, round-trip
+  * of low-cardinality wide values and range predicates on packed codes
+  * against a direct evaluation, ranges between and outside the values.
+  */
+bool check_dictionary(dict::GatherFn gather) {
+    dict::Dictionary dictionary(1);
+    for (u64 v = 0; v < 1000; v++) {
+        if (dictionary.insert(v * 0x100000001ull) != v) {
+            std::cout << "Dictionary insert error: " << v << std::endl;
             return false;
         }
-        if (!stream_.put_raw(bits1)) {
+    }
+    u32 code;
+    if (!dictionary.find(999 * 0x100000001ull, &code) || code != 999 || dictionary.find(5, &code)
+        || dictionary.width() != 10) {
+        std::cout << "Dictionary find error" << std::endl;
+        return false;
+    }
+    const int cardinalities[] = {1, 2, 3, 17, 200, 5000};
+    for (size_t c = 0; c < sizeof(cardinalities)/sizeof(cardinalities[0]); c++) {
+        workload::Rng rng(cardinalities[c]);
+        std::vector<u64> ids(cardinalities[c]);
+        for (size_t i = 0; i < ids.size(); i++) {
+            ids[i] = rng.next() | 1ull << 63;
+        }
+        std::vector<u64> expected(16*300 + 7);
+        for (size_t i = 0; i < expected.size(); i++) {
+            expected[i] = ids[rng.below(ids.size())];
+        }
+        MemoryStream stream(DictionaryEncoder::max_size(expected.size()));
+        DictionaryEncoder encoder(stream, best_kernels(), gather);
+        if (!encoder.pack(expected.data(), expected.size())) {
+            std::cout << "Dictionary pack error, cardinality: " << cardinalities[c] << std::endl;
             return false;
         }
-        if (!stream_.put_raw(bits2)) {
+        stream.reset();
+        std::vector<u64> output(expected.size() + 1, 0xDEADull);
+        encoder.unpack(output.data(), expected.size());
+        if (!std::equal(expected.begin(), expected.end(), output.begin()) || output.back() != 0xDEADull) {
+            std::cout << "Dictionary unpack error, cardinality: " << cardinalities[c] << std::endl;
             return false;
         }
-        return true;
+        std::sort(ids.begin(), ids.end());
+        const u64 ranges[][2] = {
+            {0, ~0ull}, {ids[0], ids[0]}, {ids[0] + 1, ids.back()}, {ids.back(), ~0ull},
+            {ids[ids.size() / 2], ids[ids.size() / 2] + (1ull << 60)}, {0, ids[0] - 1}, {ids.back(), ids[0]},
+        };
+        for (size_t r = 0; r < sizeof(ranges)/sizeof(ranges[0]); r++) {
+            stream.reset();
+            std::vector<u8> bitmap((expected.size() + 15) / 16 * 2, 0xFF);
+            encoder.scan_range(ranges[r][0], ranges[r][1], expected.size(), bitmap.data());
+            for (size_t i = 0; i < 8*bitmap.size(); i++) {
+                const bool match = i < expected.size() && expected[i] >= ranges[r][0] && expected[i] <= ranges[r][1];
+                if (((bitmap[i / 8] >> i % 8) & 1) != match) {
+                    std::cout << "Dictionary scan error, cardinality: " << cardinalities[c]
+                              << ", range: " << r << ", index: " << i << std::endl;
+                    return false;
+                }
+            }
+        }
     }
+    return true;
+}
 
-    void _unpack7(u64* output, int shift) {
-        u64 bits0  = stream_.read_raw<u64>();
-        u64 bits1  = stream_.read_raw<u32>();
-        u64 bits2  = stream_.read_raw<u16>();
-        output[0]  |= ((bits0 & 0x7F)) << shift;
-        output[1]  |= ((bits0 & (0x7Full <<  7)) >>  7) << shift;
-        output[2]  |= ((bits0 & (0x7Full << 14)) >> 14) << shift;
-        output[3]  |= ((bits0 & (0x7Full << 21)) >> 21) << shift;
-        output[4]  |= ((bits0 & (0x7Full << 28)) >> 28) << shift;
-        output[5]  |= ((bits0 & (0x7Full << 35)) >> 35) << shift;
-        output[6]  |= ((bits0 & (0x7Full << 42)) >> 42) << shift;
-        output[7]  |= ((bits0 & (0x7Full << 49)) >> 49) << shift;
-        output[8]  |= ((bits0 & (0x7Full << 56)) >> 56) << shift;
-        output[9]  |= (((bits0 & (0x01ull << 63)) >> 63) | ((bits1 & 0x3F) << 1)) << shift;
-        output[10] |= ((bits1 & (0x7Full <<  6)) >>  6) << shift;
-        output[11] |= ((bits1 & (0x7Full << 13)) >> 13) << shift;
-        output[12] |= ((bits1 & (0x7Full << 20)) >> 20) << shift;
-        output[13] |= (((bits1 & (0x1Full << 27)) >> 27) | ((bits2 & 0x03) << 5)) << shift;
-        output[14] |= ((bits2 & (0x7Full <<  2)) >>  2) << shift;
-        output[15] |= ((bits2 & (0x7Full <<  9)) >>  9) << shift;
+/** Float codec round-trip must be bit-exact: decimal prices, integers,
+  * special values (NaN, infinities, -0.0, denormals) as exceptions and
+  * random doubles stored raw, switching between them so that raw blocks
+  * go back to scaled ones. Prices should take well below 8 bytes.
+  */
+bool check_float() {
+    workload::Rng rng(workload::DEFAULT_SEED);
+    const double special[] = {
+        std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(), -0.0, std::numeric_limits<double>::denorm_min(), 1e300, 0.1 + 0.2,
+    };
+    std::vector<double> expected;
+    double price = 100;
+    for (int b = 0; b < 400; b++) {
+        for (int i = 0; i < 16; i++) {
+            price += static_cast<double>(static_cast<i64>(rng.below(201)) - 100) / 100;
+            double value = std::round(price * 100) / 100;
+            if (b / 50 % 4 == 1) {
+                value = static_cast<double>(rng.next() >> 20);
+            } else if (b / 50 % 4 == 3) {
+                const u64 bits = (rng.next() & ~(0x7FFull << 52)) | (static_cast<u64>(1023 + rng.below(20)) << 52);
+                std::memcpy(&value, &bits, sizeof(value));
+            } else if (b % 7 == 0 && i % 5 == 0) {
+                value = special[(b + i) % 7];
+            }
+            expected.push_back(value);
+        }
     }
+    MemoryStream stream(expected.size()*9);
+    FloatEncoder encoder(stream);
+    size_t price_bytes = 0;
+    for (size_t i = 0; i < expected.size(); i += 16) {
+        const size_t before = stream.size();
+        if (!encoder.pack(expected.data() + i)) {
+            std::cout << "Float pack error, block: " << i / 16 << std::endl;
+            return false;
+        }
+        price_bytes += i / 16 / 50 % 4 == 0 ? stream.size() - before : 0;
+    }
+    stream.reset();
+    FloatEncoder decoder(stream);
+    for (size_t i = 0; i < expected.size(); i += 16) {
+        double output[16];
+        decoder.unpack(output);
+        if (std::memcmp(output, expected.data() + i, sizeof(output)) != 0) {
+            std::cout << "Float unpack error, block: " << i / 16 << std::endl;
+            return false;
+        }
+    }
+    // 100 blocks of prices
+    if (price_bytes > 100*16*4) {
+        std::cout << "Float size error: " << price_bytes << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    template<typename T>
-    void _shiftN(u64* input) {
-        for (int i = 0; i < 16; i++) {
-            input[i] >>= 8*sizeof(T);
+//! Chunked round-trip with partial last block and chunk, several arrays in one stream
+bool check_chunked(int nthreads, const KernelTable& kernels) {
+    ThreadPool pool(nthreads);
+    const size_t sizes[] = {0, 5, 1024, 100003};
+    std::vector<std::vector<u64> > arrays;
+    size_t total = 0;
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+        workload::Uniform gen(0xFFFFF);
+        std::vector<u64> values;
+        for (size_t i = 0; i < sizes[s]; i++) {
+            values.push_back(gen.generate() << (i / 4096 % 40));
+        }
+        arrays.push_back(values);
+        total += values.size();
+    }
+    MemoryStream stream(AdaptiveEncoder::max_size(total/16 + 64) + 1024);
+    ChunkedEncoder encoder(stream, pool, 4096, kernels);
+    for (size_t a = 0; a < arrays.size(); a++) {
+        if (!encoder.pack(arrays[a].data(), arrays[a].size())) {
+            std::cout << "Chunked pack error, array: " << a << std::endl;
+            return false;
         }
     }
+    stream.reset();
+    for (size_t a = 0; a < arrays.size(); a++) {
+        std::vector<u64> output;
+        encoder.unpack(output);
+        if (output != arrays[a]) {
+            std::cout << "Chunked unpack error, threads: " << nthreads << ", array: " << a << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
 
-    bool pack(u64* input, int n) {
-        switch(n) {
-        case 0:
-            return true;
-        case 1:
-            return _pack1(input);
-        case 2:
-            return _pack2(input);
-        case 3:
-            return _pack3(input);
-        case 4:
-            return _pack4(input);
-        case 5:
-            return _pack5(input);
-        case 6:
-            return _pack6(input);
-        case 7:
-            return _pack7(input);
-        case 8:
-            return _packN<u8>(input);
-        case 9:
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack1(input);
-        case 10:
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack2(input);
-        case 11:
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack3(input);
-        case 12:
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack4(input);
-        case 13:
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack5(input);
-        case 14:
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack6(input);
-        case 15:
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack7(input);
-        case 16:
-            return _packN<u16>(input);
-        case 17:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack1(input);
-        case 18:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack2(input);
-        case 19:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack3(input);
-        case 20:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack4(input);
-        case 21:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack5(input);
-        case 22:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack6(input);
-        case 23:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack7(input);
-        case 24:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _packN<u8>(input);
-        case 25:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack1(input);
-        case 26:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack2(input);
-        case 27:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack3(input);
-        case 28:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack4(input);
-        case 29:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack5(input);
-        case 30:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack6(input);
-        case 31:
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack7(input);
-        case 32:
-            return _packN<u32>(input);
-        case 33:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            return _pack1(input);
-        case 34:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            return _pack2(input);
-        case 35:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            return _pack3(input);
-        case 36:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            return _pack4(input);
-        case 37:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            return _pack5(input);
-        case 38:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            return _pack6(input);
-        case 39:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            return _pack7(input);
-        case 40:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            return _packN<u8>(input);
-        case 41:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack1(input);
-        case 42:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack2(input);
-        case 43:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack3(input);
-        case 44:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack4(input);
-        case 45:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack5(input);
-        case 46:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack6(input);
-        case 47:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack7(input);
-        case 48:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            return _packN<u16>(input);
-        case 49:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack1(input);
-        case 50:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack2(input);
-        case 51:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack3(input);
-        case 52:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack4(input);
-        case 53:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack5(input);
-        case 54:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack6(input);
-        case 55:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _pack7(input);
-        case 56:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            return _packN<u8>(input);
-        case 57:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack1(input);
-        case 58:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack2(input);
-        case 59:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack3(input);
-        case 60:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack4(input);
-        case 61:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack5(input);
-        case 62:
-            if (!_packN<u32>(input)) {
-                return false;
-            }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
-            }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
-            }
-            _shiftN<u8>(input);
-            return _pack6(input);
-        case 63:
-            if (!_packN<u32>(input)) {
-                return false;
+/** Column file round-trip: values appended in uneven pieces, partial
+  * last block, random access and ranges through the mapping.
+  */
+bool check_column() {
+    char path[] = "/tmp/bitpack_column_XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        std::cout << "Can't create a temporary file" << std::endl;
+        return false;
+    }
+    close(fd);
+    std::vector<u64> expected = workload::generate(workload::SPARSE_COUNTERS, 16*1000 + 7);
+    const std::vector<u64> walk = workload::generate(workload::RANDOM_WALK, 5000);
+    expected.insert(expected.begin() + 3000, walk.begin(), walk.end());
+    bool ok = true;
+    try {
+        {
+            ColumnWriter writer(path, best_kernels(), 16);
+            const size_t pieces[] = {0, 5, 11, 16, 1000, 3};
+            size_t pos = 0;
+            for (size_t p = 0; pos < expected.size(); p++) {
+                const size_t count = std::min(pieces[p % 6], expected.size() - pos);
+                writer.append(expected.data() + pos, count);
+                pos += count;
             }
-            _shiftN<u32>(input);
-            if (!_packN<u16>(input)) {
-                return false;
+        }
+        ColumnReader reader(path);
+        std::vector<u64> output(expected.size());
+        reader.decode_range(0, expected.size(), output.data());
+        ok = reader.size() == expected.size() && output == expected;
+        for (u64 i = 0; ok && i < expected.size(); i += 997) {
+            ok = reader.get(i) == expected[i];
+        }
+        const u64 ranges[][2] = {{0, 0}, {3, 29}, {16*17 + 5, 16*80}, {20000, expected.size()}};
+        for (size_t r = 0; ok && r < sizeof(ranges)/sizeof(ranges[0]); r++) {
+            std::vector<u64> part(ranges[r][1] - ranges[r][0]);
+            reader.decode_range(ranges[r][0], ranges[r][1], part.data());
+            ok = std::equal(part.begin(), part.end(), expected.begin() + ranges[r][0]);
+        }
+        // block accessors check the index
+        for (int access = 0; ok && access < 3; access++) {
+            try {
+                u64 block[16];
+                if (access == 0) {
+                    reader.width(reader.nblocks());
+                } else if (access == 1) {
+                    reader.block_data(reader.nblocks());
+                } else {
+                    reader.unpack_block(reader.nblocks(), block);
+                }
+                ok = false;
+            } catch (const std::out_of_range&) {
             }
-            _shiftN<u16>(input);
-            if (!_packN<u8>(input)) {
-                return false;
+        }
+        // truncated file is rejected on open
+        if (ok && truncate(path, 100) == 0) {
+            try {
+                ColumnReader broken(path);
+                ok = false;
+            } catch (const std::runtime_error&) {
             }
-            _shiftN<u8>(input);
-            return _pack7(input);
-        case 64:
-            return _packN<u64>(input);
         }
+    } catch (const std::exception& e) {
+        std::cout << "Column file error: " << e.what() << std::endl;
+        ok = false;
+    }
+    unlink(path);
+    if (!ok) {
+        std::cout << "Column file round-trip error" << std::endl;
     }
+    return ok;
+}
 
-    void unpack(u64* output, int n) {
-        switch(n) {
-        case 0:
-            break;
-        case 1:
-            _unpack1(output, 0);
-            break;
-        case 2:
-            _unpack2(output, 0);
-            break;
-        case 3:
-            _unpack3(output, 0);
-            break;
-        case 4:
-            _unpack4(output, 0);
-            break;
-        case 5:
-            _unpack5(output, 0);
-            break;
-        case 6:
-            _unpack6(output, 0);
-            break;
-        case 7:
-            _unpack7(output, 0);
-            break;
-        case 8:
-            _unpackN<u8>(output, 0);
-            break;
-        case 9:
-            _unpackN<u8>(output, 0);
-            _unpack1(output, 8);
-            break;
-        case 10:
-            _unpackN<u8>(output, 0);
-            _unpack2(output, 8);
-            break;
-        case 11:
-            _unpackN<u8>(output, 0);
-            _unpack3(output, 8);
-            break;
-        case 12:
-            _unpackN<u8>(output, 0);
-            _unpack4(output, 8);
-            break;
-        case 13:
-            _unpackN<u8>(output, 0);
-            _unpack5(output, 8);
-            break;
-        case 14:
-            _unpackN<u8>(output, 0);
-            _unpack6(output, 8);
-            break;
-        case 15:
-            _unpackN<u8>(output, 0);
-            _unpack7(output, 8);
-            break;
-        case 16:
-            _unpackN<u16>(output, 0);
-            break;
-        case 17:
-            _unpackN<u16>(output, 0);
-            _unpack1(output, 16);
-            break;
-        case 18:
-            _unpackN<u16>(output, 0);
-            _unpack2(output, 16);
-            break;
-        case 19:
-            _unpackN<u16>(output, 0);
-            _unpack3(output, 16);
-            break;
-        case 20:
-            _unpackN<u16>(output, 0);
-            _unpack4(output, 16);
-            break;
-        case 21:
-            _unpackN<u16>(output, 0);
-            _unpack5(output, 16);
-            break;
-        case 22:
-            _unpackN<u16>(output, 0);
-            _unpack6(output, 16);
-            break;
-        case 23:
-            _unpackN<u16>(output, 0);
-            _unpack7(output, 16);
-            break;
-        case 24:
-            _unpackN<u16>(output, 0);
-            _unpackN<u8>(output, 16);
-            break;
-        case 25:
-            _unpackN<u16>(output, 0);
-            _unpackN<u8>(output, 16);
-            _unpack1(output, 24);
-            break;
-        case 26:
-            _unpackN<u16>(output, 0);
-            _unpackN<u8>(output, 16);
-            _unpack2(output, 24);
-            break;
-        case 27:
-            _unpackN<u16>(output, 0);
-            _unpackN<u8>(output, 16);
-            _unpack3(output, 24);
-            break;
-        case 28:
-            _unpackN<u16>(output, 0);
-            _unpackN<u8>(output, 16);
-            _unpack4(output, 24);
-            break;
-        case 29:
-            _unpackN<u16>(output, 0);
-            _unpackN<u8>(output, 16);
-            _unpack5(output, 24);
-            break;
-        case 30:
-            _unpackN<u16>(output, 0);
-            _unpackN<u8>(output, 16);
-            _unpack6(output, 24);
-            break;
-        case 31:
-            _unpackN<u16>(output, 0);
-            _unpackN<u8>(output, 16);
-            _unpack7(output, 24);
-            break;
-        case 32:
-            _unpackN<u32>(output, 0);
-            break;
-        case 33:
-            _unpackN<u32>(output, 0);
-            _unpack1(output, 32);
-            break;
-        case 34:
-            _unpackN<u32>(output, 0);
-            _unpack2(output, 32);
-            break;
-        case 35:
-            _unpackN<u32>(output, 0);
-            _unpack3(output, 32);
-            break;
-        case 36:
-            _unpackN<u32>(output, 0);
-            _unpack4(output, 32);
-            break;
-        case 37:
-            _unpackN<u32>(output, 0);
-            _unpack5(output, 32);
-            break;
-        case 38:
-            _unpackN<u32>(output, 0);
-            _unpack6(output, 32);
-            break;
-        case 39:
-            _unpackN<u32>(output, 0);
-            _unpack7(output, 32);
-            break;
-        case 40:
-            _unpackN<u32>(output, 0);
-            _unpackN<u8>(output, 32);
-            break;
-        case 41:
-            _unpackN<u32>(output, 0);
-            _unpackN<u8>(output, 32);
-            _unpack1(output, 40);
-            break;
-        case 42:
-            _unpackN<u32>(output, 0);
-            _unpackN<u8>(output, 32);
-            _unpack2(output, 40);
-            break;
-        case 43:
-            _unpackN<u32>(output, 0);
-            _unpackN<u8>(output, 32);
-            _unpack3(output, 40);
-            break;
-        case 44:
-            _unpackN<u32>(output, 0);
-            _unpackN<u8>(output, 32);
-            _unpack4(output, 40);
-            break;
-        case 45:
-            _unpackN<u32>(output, 0);
-            _unpackN<u8>(output, 32);
-            _unpack5(output, 40);
-            break;
-        case 46:
-            _unpackN<u32>(output, 0);
-            _unpackN<u8>(output, 32);
-            _unpack6(output, 40);
-            break;
-        case 47:
-            _unpackN<u32>(output, 0);
-            _unpackN<u8>(output, 32);
-            _unpack7(output, 40);
-            break;
-        case 48:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            break;
-        case 49:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpack1(output, 48);
-            break;
-        case 50:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpack2(output, 48);
-            break;
-        case 51:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpack3(output, 48);
-            break;
-        case 52:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpack4(output, 48);
-            break;
-        case 53:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpack5(output, 48);
-            break;
-        case 54:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpack6(output, 48);
-            break;
-        case 55:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpack7(output, 48);
-            break;
-        case 56:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpackN<u8>(output, 48);
-            break;
-        case 57:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpackN<u8>(output, 48);
-            _unpack1(output, 56);
-            break;
-        case 58:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpackN<u8>(output, 48);
-            _unpack2(output, 56);
-            break;
-        case 59:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpackN<u8>(output, 48);
-            _unpack3(output, 56);
-            break;
-        case 60:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpackN<u8>(output, 48);
-            _unpack4(output, 56);
-            break;
-        case 61:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpackN<u8>(output, 48);
-            _unpack5(output, 56);
-            break;
-        case 62:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpackN<u8>(output, 48);
-            _unpack6(output, 56);
-            break;
-        case 63:
-            _unpackN<u32>(output, 0);
-            _unpackN<u16>(output, 32);
-            _unpackN<u8>(output, 48);
-            _unpack7(output, 56);
-            break;
-        case 64:
-            _unpackN<u64>(output, 0);
-            break;
+/** Aggregates on the packed stream should match the ones computed on
+  * the values: zero blocks, all widths and a partial last block.
+  */
+bool check_aggregates(const KernelTable& kernels) {
+    const int nblocks = 300;
+    std::vector<u64> values;
+    for (int b = 0; b < nblocks; b++) {
+        const int n = b % 3 == 0 ? 0 : (b * 11) % 65;
+        workload::Uniform gen(n == 64 ? ~0ull : (1ull << n) - 1);
+        for (int i = 0; i < 16; i++) {
+            values.push_back(gen.generate());
         }
     }
-
-    bool dumb_pack(const u64* input, int n) {
-        int size = 16;
-        u8 bits = 0;
-        int ixbits = 0;
-        for (int i = 0; i < size; i++) {
-            u64 word = input[i];
-            for (int ixword = 0; ixword < n; ixword++) {
-                if (word & 1) {
-                    bits |= (1 << ixbits);
-                }
-                ixbits++;
-                word >>= 1;
-                if (ixbits == 8) {
-                    if (!stream_.put_raw(static_cast<u8>(bits))) {
-                        return false;
-                    }
-                    ixbits = 0;
-                    bits = 0;
-                }
+    MemoryStream stream(AdaptiveEncoder::max_size(nblocks));
+    AdaptiveEncoder encoder(stream);
+    for (int b = 0; b < nblocks; b++) {
+        encoder.pack(values.data() + 16*b);
+    }
+    const u64 counts[] = {0, 16, 100, 16*nblocks - 5, 16*nblocks};
+    for (size_t c = 0; c < sizeof(counts)/sizeof(counts[0]); c++) {
+        const u64 count = counts[c];
+        Totals expected = {count, 0, count ? ~0ull : 0, 0};
+        std::vector<u64> hist_expected(10), hist(10);
+        for (u64 i = 0; i < count; i++) {
+            expected.sum += values[i];
+            expected.min = std::min(expected.min, values[i]);
+            expected.max = std::max(expected.max, values[i]);
+            if (values[i] < 1000) {
+                hist_expected[values[i] / 100]++;
             }
         }
-        if (ixbits != 0 && n != 0) {
-            if (!stream_.put_raw(static_cast<u8>(bits))) {
-                return false;
-            }
+        const Totals totals = aggregate_totals(stream.data(), stream.size(), count, kernels);
+        aggregate_histogram(stream.data(), stream.size(), count, 0, 100, 10, hist.data(), kernels);
+        if (totals.count != expected.count || totals.sum != expected.sum ||
+            totals.min != expected.min || totals.max != expected.max || hist != hist_expected) {
+            std::cout << "Aggregate error, count: " << count << std::endl;
+            return false;
         }
-        return true;
     }
+    return true;
+}
 
-    void dumb_unpack(u64* output, int n) {
-        int size = 16;
-        u8 bits = 0;
-        int bitindex = 8;
-        for (auto ixout = 0; ixout < size; ixout++) {
-            u64 current = 0;
-            for (int ixbit = 0; ixbit < n; ixbit++) {
-                if (bitindex == 8) {
-                    bitindex = 0;
-                    bits = stream_.template read_raw<u8>();
-                }
-                if (bits & 1) {
-                    current |= 1ull << ixbit;
+/** Selection bitmaps of the scan kernels should match decode-then-filter
+  * for every width, ranges and equality on values present in the data.
+  */
+bool check_scan(const scan::ScanTable& table) {
+    const int nblocks = 32;
+    for (int n = 0; n <= 64; n++) {
+        const u64 max = n == 64 ? ~0ull : (1ull << n) - 1;
+        workload::Uniform gen(max);
+        std::vector<u64> values;
+        MemoryStream stream(128*nblocks);
+        Encoder encoder(stream);
+        for (int b = 0; b < nblocks; b++) {
+            u64 input[16];
+            for (int i = 0; i < 16; i++) {
+                input[i] = gen.generate();
+                values.push_back(input[i]);
+            }
+            encoder.pack(input, n);
+        }
+        const u64 ranges[][2] = {
+            {0, max}, {values[5], values[5]}, {values[7] / 2, values[7]},
+            {max / 3, max / 3 * 2}, {values[9], ~0ull}, {1, 0}, {max, max},
+        };
+        for (size_t r = 0; r < sizeof(ranges)/sizeof(ranges[0]); r++) {
+            const u64 lo = ranges[r][0], hi = ranges[r][1];
+            std::vector<u8> bitmap(2*nblocks);
+            stream.reset();
+            Scanner scanner(stream, table);
+            scanner.scan_range(n, nblocks, lo, hi, bitmap.data());
+            for (size_t i = 0; i < values.size(); i++) {
+                const bool expected = lo <= values[i] && values[i] <= hi;
+                if (((bitmap[i / 8] >> (i % 8)) & 1) != expected) {
+                    std::cout << "Scan " << table.name << " error, width: " << n
+                              << ", range: " << r << ", index: " << i << std::endl;
+                    return false;
                 }
-                bits >>= 1;
-                bitindex++;
             }
-            output[ixout] = current;
         }
     }
-};
+    return true;
+}
 
-int get_bit_width(u64 x) {
-    if (x == 0) {
-        return 64;
+/** Every distribution should be reproducible from its seed and round-trip
+  * through the adaptive, FOR, PFOR and delta codecs.
+  */
+bool check_workloads() {
+    const size_t nvalues = 16*256;
+    for (int d = 0; d < workload::DISTRIBUTION_COUNT; d++) {
+        const workload::Distribution dist = static_cast<workload::Distribution>(d);
+        const std::vector<u64> values = workload::generate(dist, nvalues, 42);
+        if (values != workload::generate(dist, nvalues, 42) || values == workload::generate(dist, nvalues, 43)) {
+            std::cout << "Workload " << workload::distribution_name(dist) << " is not seeded" << std::endl;
+            return false;
+        }
+        MemoryStream stream(AdaptiveEncoder::max_size(nvalues/16) + 32*nvalues);
+        AdaptiveEncoder adaptive(stream);
+        ForEncoder frame(stream);
+        PforEncoder pfor(stream);
+        DeltaEncoder delta(stream);
+        for (size_t i = 0; i < nvalues; i += 16) {
+            adaptive.pack(values.data() + i);
+        }
+        for (size_t i = 0; i < nvalues; i += 16) {
+            frame.pack(values.data() + i);
+            pfor.pack(values.data() + i);
+            delta.pack(values.data() + i);
+        }
+        adaptive.rewind();
+        std::vector<u64> output(nvalues);
+        for (size_t i = 0; i < nvalues; i += 16) {
+            adaptive.unpack(output.data() + i);
+        }
+        bool ok = output == values;
+        for (size_t i = 0; ok && i < nvalues; i += 16) {
+            u64 a[16], b[16], c[16];
+            frame.unpack(a);
+            pfor.unpack(b);
+            delta.unpack(c);
+            ok = std::equal(a, a + 16, values.data() + i) && std::equal(b, b + 16, values.data() + i)
+              && std::equal(c, c + 16, values.data() + i);
+        }
+        if (!ok) {
+            std::cout << "Workload " << workload::distribution_name(dist) << " round-trip error" << std::endl;
+            return false;
+        }
     }
-    return 64 - __builtin_clzl(x);
+    return true;
 }
 
 int main(int argc, char *argv[])
 {
     const size_t N = 1000000;
     std::vector<u64> masks = {0xF};
-//    u64 full = 0xFFFFFFFFFFFFFFFFull;
-//    for (int i = 0; i < 64; i++) {
-//        masks.push_back(full >> i);
-//    }
+    u64 full = 0xFFFFFFFFFFFFFFFFull;
+    for (int i = 0; i < 64; i++) {
+        masks.push_back(full >> i);
+    }
     int run = 0;
+    bool success = true;
     for (u64 mask: masks) {
         try {
-            RandomWalk rwalk(mask);
-            MemoryStream stream(0x10000);
-            Encoder encoder(stream);
+            workload::Uniform gen(mask);
+            GrowableSink sink;
+            BasicEncoder<GrowableSink> encoder(sink);
             std::vector<u64> expected;
             const int stride = 16;
             for (size_t i = 0; i < N; i += stride) {
                 u64 input[stride];
                 for (int j = 0; j < stride; j++) {
-                    input[j] = rwalk.generate();
+                    input[j] = gen.generate();
                 }
                 std::copy(input, input + stride, std::back_inserter(expected));
-                bool res = encoder.pack(input, get_bit_width(mask));
-                if (!res) {
-                    expected.resize(expected.size() - stride);
-                    break;
+                if (!encoder.pack(input, get_bit_width(mask))) {
+                    std::cout << "Pack error at run " << run << ", mask:" << std::hex << mask << std::endl;
+                    throw "pack error";
                 }
             }
             // Read back
-            stream.reset();
+            BufferSource source(sink.data(), sink.size());
+            BasicEncoder<BufferSource> decoder(source);
             for (u32 i = 0; i < expected.size(); i += stride) {
-                u64 output[stride] = {};
-                encoder.unpack(output, get_bit_width(mask));
+                u64 output[stride];
+                if (decoder.unpack(output, get_bit_width(mask)) != STATUS_OK) {
+                    std::cout << "Unpack error at run " << run << ", mask:" << std::hex << mask << std::endl;
+                    throw "unpack error";
+                }
                 for (u32 j = 0; j < stride; j++) {
                     auto actual = output[j];
                     auto expect = expected[i + j];
@@ -1264,8 +1120,83 @@ int main(int argc, char *argv[])
             }
         }
         catch (...) {
+            success = false;
         }
         run++;
     }
-    return 0;
+    const CpuFeatures& cpu = cpu_features();
+    success = check_kernels(kernel_table<ScalarKernels>()) && success;
+    success = check_kernels(best_kernels()) && success;
+    success = check_status(kernel_table<ScalarKernels>()) && success;
+    success = check_status(best_kernels()) && success;
+    success = check_sinks() && success;
+    if (cpu.sse41) {
+        success = check_kernels(kernel_table<Sse41Kernels>()) && success;
+    }
+    if (cpu.avx2) {
+        success = check_kernels(kernel_table<Avx2Kernels>()) && success;
+    }
+    if (cpu.avx512f) {
+        success = check_kernels(kernel_table<Avx512Kernels>()) && success;
+    }
+    if (cpu.bmi2) {
+        success = check_kernels(kernel_table<Bmi2Kernels<ScalarKernels> >()) && success;
+        if (cpu.avx2) {
+            success = check_kernels(kernel_table<Bmi2Kernels<Avx2Kernels> >()) && success;
+        }
+        if (cpu.avx512f) {
+            success = check_kernels(kernel_table<Bmi2Kernels<Avx512Kernels> >()) && success;
+        }
+    }
+    success = check_fixed_width<0>() && success;
+    success = check_fixed_width<5>() && success;
+    success = check_fixed_width<12>() && success;
+    success = check_fixed_width<33>() && success;
+    success = check_fixed_width<57>() && success;
+    success = check_fixed_width<64>() && success;
+    success = check_typed<u8>("u8") && success;
+    success = check_typed<u16>("u16") && success;
+    success = check_typed<u32>("u32") && success;
+    success = check_typed<i32>("i32") && success;
+    success = check_typed<i64>("i64") && success;
+    success = check_vertical<4>(vertical::scalar_kernels<4>()) && success;
+    success = check_vertical<8>(vertical::scalar_kernels<8>()) && success;
+    if (cpu.avx2) {
+        success = check_vertical<4>(vertical::avx2_kernels<4>()) && success;
+        success = check_vertical<8>(vertical::avx2_kernels<8>()) && success;
+    }
+    if (cpu.avx512f) {
+        success = check_vertical<8>(vertical::avx512_kernels()) && success;
+    }
+    success = check_adaptive() && success;
+    success = check_index(1, kernel_table<ScalarKernels>()) && success;
+    success = check_index(8, best_kernels()) && success;
+    success = check_chunked(1, kernel_table<ScalarKernels>()) && success;
+    success = check_chunked(4, best_kernels()) && success;
+    success = check_column() && success;
+    success = check_cursor(kernel_table<ScalarKernels>()) && success;
+    success = check_cursor(best_kernels()) && success;
+    success = check_rle() && success;
+    success = check_parquet() && success;
+    success = check_dictionary(&dict::gather_scalar) && success;
+    success = check_float() && success;
+    success = check_aggregates(kernel_table<ScalarKernels>()) && success;
+    success = check_aggregates(best_kernels()) && success;
+    success = check_workloads() && success;
+    success = check_scan(scan::scalar_table()) && success;
+    success = check_for() && success;
+    success = check_pfor() && success;
+    success = check_delta(delta::scalar_kernels()) && success;
+    if (cpu.avx2) {
+        success = check_delta(delta::avx2_kernels()) && success;
+        success = check_dictionary(&dict::gather_avx2) && success;
+    }
+    if (cpu.avx512f) {
+        success = check_delta(delta::avx512_kernels()) && success;
+        success = check_dictionary(&dict::gather_avx512) && success;
+    }
+    if (cpu.avx512bw && cpu.avx512vl && cpu.bmi2) {
+        success = check_scan(scan::avx512_table()) && success;
+    }
+    return success ? 0 : 1;
 }
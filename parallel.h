@@ -0,0 +1,285 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "adaptive.h"
+
+/** Work-stealing thread pool. Tasks of a `run` call are split between
+  * per-thread queues, every thread takes tasks from the front of its
+  * own queue and steals from the back of the others when it runs out.
+  * Calling thread takes part in the work.
+  */
+class ThreadPool {
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::thread> threads_;
+    //! Queue 0 belongs to the calling thread
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(size_t)>* task_;
+    std::atomic<size_t> pending_;
+    std::exception_ptr error_;
+    u64 generation_;
+    bool stop_;
+
+    bool _pop(size_t self, size_t* task) {
+        Queue& queue = *queues_[self];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        *task = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    bool _steal(size_t self, size_t* task) {
+        for (size_t i = 1; i < queues_.size(); i++) {
+            Queue& queue = *queues_[(self + i) % queues_.size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (!queue.tasks.empty()) {
+                *task = queue.tasks.back();
+                queue.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void _work(size_t self) {
+        size_t task;
+        while (_pop(self, &task) || _steal(self, &task)) {
+            try {
+                (*task_)(task);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(lock_);
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+            }
+            if (--pending_ == 0) {
+                std::lock_guard<std::mutex> guard(lock_);
+                done_.notify_all();
+            }
+        }
+    }
+
+    void _loop(size_t self) {
+        u64 seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock_);
+                wake_.wait(guard, [&] { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+            }
+            _work(self);
+        }
+    }
+public:
+    explicit ThreadPool(int nthreads = std::thread::hardware_concurrency())
+        : task_(nullptr)
+        , pending_(0)
+        , generation_(0)
+        , stop_(false)
+    {
+        nthreads = std::max(nthreads, 1);
+        for (int i = 0; i < nthreads; i++) {
+            queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+        }
+        for (int i = 1; i < nthreads; i++) {
+            threads_.push_back(std::thread(&ThreadPool::_loop, this, i));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (size_t i = 0; i < threads_.size(); i++) {
+            threads_[i].join();
+        }
+    }
+
+    size_t size() const {
+        return queues_.size();
+    }
+
+    /** Run `task(i)` for every i in [0, ntasks) and wait for completion.
+      * First exception thrown by a task is rethrown here.
+      */
+    void run(size_t ntasks, const std::function<void(size_t)>& task) {
+        if (ntasks == 0) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            task_ = &task;
+            error_ = nullptr;
+            pending_ = ntasks;
+            // contiguous ranges, neighbouring tasks stay on one thread
+            for (size_t q = 0; q < queues_.size(); q++) {
+                std::lock_guard<std::mutex> qguard(queues_[q]->lock);
+                const size_t begin = ntasks*q / queues_.size();
+                const size_t end = ntasks*(q + 1) / queues_.size();
+                for (size_t i = begin; i < end; i++) {
+                    queues_[q]->tasks.push_back(i);
+                }
+            }
+            generation_++;
+        }
+        wake_.notify_all();
+        _work(0);
+        std::unique_lock<std::mutex> guard(lock_);
+        done_.wait(guard, [&] { return pending_ == 0; });
+        task_ = nullptr;
+        if (error_) {
+            std::exception_ptr error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+/** Parallel encoder for large arrays. Input is split into chunks of
+  * `chunk_size` values, every chunk is an independent adaptive stream.
+  * Layout: u64 number of values, u32 number of chunks, u32 chunk size,
+  * chunk directory (u64 end offset of every chunk relative to the first
+  * one), then chunks one after another.
+  */
+class ChunkedEncoder {
+    MemoryStream &stream_;
+    ThreadPool& pool_;
+    const u32 chunk_size_;
+    const KernelTable& kernels_;
+
+    enum {
+        HEADER_SIZE = 16,
+    };
+
+    //! Block of 16 values at `i`, a partial last block is zero-padded into `padded`
+    static const u64* _block(const u64* input, u64 i, u64 end, u64* padded) {
+        if (end - i >= 16) {
+            return input + i;
+        }
+        std::fill(padded, padded + 16, 0ull);
+        std::copy(input + i, input + end, padded);
+        return padded;
+    }
+public:
+    ChunkedEncoder(MemoryStream& stream, ThreadPool& pool, u32 chunk_size = 0x10000,
+                   const KernelTable& kernels = best_kernels())
+        : stream_(stream)
+        , pool_(pool)
+        , chunk_size_(chunk_size)
+        , kernels_(kernels)
+    {
+        if (chunk_size == 0 || chunk_size % 16 != 0) {
+            throw std::invalid_argument("Chunk size should be a multiple of 16");
+        }
+    }
+
+    /** Pack `count` values, returns false if the stream is full. Block
+      * widths are found first, they give the size of every chunk, so the
+      * chunks are encoded in place at their offsets.
+      */
+    bool pack(const u64* input, u64 count) {
+        const u32 nchunks = static_cast<u32>((count + chunk_size_ - 1) / chunk_size_);
+        const u64 group = AdaptiveEncoder::GROUP_SIZE;
+        std::vector<u8> widths((count + 15) / 16);
+        std::vector<u64> offsets(nchunks);
+        pool_.run(nchunks, [&](size_t c) {
+            const u64 begin = c*static_cast<u64>(chunk_size_);
+            const u64 end = std::min<u64>(count, begin + chunk_size_);
+            const u64 nblocks = (end - begin + 15) / 16;
+            u64 size = (nblocks + group - 1) / group * group;
+            for (u64 i = begin; i < end; i += 16) {
+                u64 padded[16];
+                const int n = get_block_width(_block(input, i, end, padded));
+                widths[i / 16] = static_cast<u8>(n);
+                size += 2*n;
+            }
+            offsets[c] = size;
+        });
+        u64 total = 0;
+        for (u32 c = 0; c < nchunks; c++) {
+            total += offsets[c];
+            offsets[c] = total;
+        }
+        const size_t dirsize = sizeof(u64)*nchunks;
+        u8* out = stream_.allocate(HEADER_SIZE + dirsize + total);
+        if (!out) {
+            return false;
+        }
+        std::memcpy(out, &count, sizeof(count));
+        std::memcpy(out + 8, &nchunks, sizeof(nchunks));
+        std::memcpy(out + 12, &chunk_size_, sizeof(chunk_size_));
+        std::memcpy(out + HEADER_SIZE, offsets.data(), dirsize);
+        u8* payload = out + HEADER_SIZE + dirsize;
+        pool_.run(nchunks, [&](size_t c) {
+            const u64 begin = c*static_cast<u64>(chunk_size_);
+            const u64 end = std::min<u64>(count, begin + chunk_size_);
+            const u64 nblocks = (end - begin + 15) / 16;
+            u8* pos = payload + (c ? offsets[c - 1] : 0);
+            for (u64 b = 0; b < nblocks; b++) {
+                const u64 block = begin / 16 + b;
+                if (b % group == 0) {
+                    // same layout as AdaptiveEncoder, unused width slots are zero
+                    const u64 ngroup = std::min(group, nblocks - b);
+                    std::memcpy(pos, &widths[block], ngroup);
+                    std::memset(pos + ngroup, 0, group - ngroup);
+                    pos += group;
+                }
+                u64 padded[16];
+                kernels_.write[widths[block]](_block(input, 16*block, end, padded), pos);
+                pos += 2*widths[block];
+            }
+        });
+        return true;
+    }
+
+    //! Unpack the next array, `output` is resized to the number of values
+    void unpack(std::vector<u64>& output) {
+        const u8* header = stream_.consume(HEADER_SIZE);
+        u64 count;
+        u32 nchunks, chunk_size;
+        std::memcpy(&count, header, sizeof(count));
+        std::memcpy(&nchunks, header + 8, sizeof(nchunks));
+        std::memcpy(&chunk_size, header + 12, sizeof(chunk_size));
+        if (chunk_size == 0 || (count + chunk_size - 1) / chunk_size != nchunks) {
+            throw std::out_of_range("Corrupted stream");
+        }
+        std::vector<u64> offsets(nchunks);
+        std::memcpy(offsets.data(), stream_.consume(sizeof(u64)*nchunks), sizeof(u64)*nchunks);
+        const u64 total = nchunks ? offsets.back() : 0;
+        const u8* payload = stream_.consume(total);
+        output.resize(count);
+        pool_.run(nchunks, [&](size_t c) {
+            const u64 begin = c ? offsets[c - 1] : 0;
+            if (begin > offsets[c] || offsets[c] > total) {
+                throw std::out_of_range("Corrupted stream");
+            }
+            const u64 first = c*static_cast<u64>(chunk_size);
+            adaptive_decode(payload + begin, offsets[c] - begin,
+                            std::min<u64>(count - first, chunk_size), output.data() + first, kernels_);
+        });
+    }
+};
@@ -0,0 +1,401 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#include "bitpack.h"
+#include "rle.h"
+
+/** Parquet RLE / bit-packed hybrid encoding (definition and repetition
+  * levels, dictionary indices, booleans), byte-compatible with Parquet
+  * readers and writers. All values have the same `width`, the stream is
+  * a sequence of runs with a ULEB128 header:
+  *
+  *   `count << 1`       repeated run, value in ceil(width/8) bytes
+  *   `groups << 1 | 1`  bit-packed run of `groups` 8-value groups, every
+  *                      group is `width` bytes, values LSB-first
+  *
+  * The length prefix of data page levels is not part of the stream.
+  * Bit-packed groups of width 1 have the layout of an Arrow validity
+  * bitmap and are copied into it as is.
+  */
+namespace parquet {
+
+enum {
+    //! Shortest run encoded as a repeated run
+    MIN_RUN = 8,
+};
+
+/** Encode/decode one 8-value group of N bits, `T` is any integer type
+  * wide enough for N bits. Bit offsets of all values are compile-time
+  * constants, the group is moved through u64 words in registers.
+  */
+template<typename T, int N>
+struct Kernel {
+    typedef typename std::make_unsigned<T>::type U;
+
+    enum {
+        WORDS = (8*N + 63) / 64 + 1,
+    };
+
+    static u64 _mask() {
+        return N == 64 ? ~0ull : (1ull << N) - 1;
+    }
+
+    static void write(const T* input, u8* output) {
+        u64 words[WORDS] = {};
+#pragma GCC unroll 8
+        for (int i = 0; i < 8; i++) {
+            const u64 value = static_cast<U>(input[i]) & _mask();
+            const int bit = i*N;
+            words[bit / 64] |= value << (bit % 64);
+            if (bit % 64 + N > 64) {
+                words[bit / 64 + 1] |= value >> ((64 - bit % 64) & 63);
+            }
+        }
+        std::memcpy(output, words, N);
+    }
+
+    static void read(const u8* input, T* output) {
+        u64 words[WORDS] = {};
+        std::memcpy(words, input, N);
+#pragma GCC unroll 8
+        for (int i = 0; i < 8; i++) {
+            const int bit = i*N;
+            u64 value = words[bit / 64] >> (bit % 64);
+            if (bit % 64 + N > 64) {
+                value |= words[bit / 64 + 1] << ((64 - bit % 64) & 63);
+            }
+            output[i] = static_cast<T>(value & _mask());
+        }
+    }
+};
+
+template<typename T>
+struct Table {
+    //! Encode/decode one 8-value group, `N` bytes
+    typedef void (*WriteFn)(const T* input, u8* output);
+    typedef void (*ReadFn)(const u8* input, T* output);
+
+    enum {
+        MAX_WIDTH = 8*sizeof(T),
+    };
+
+    //! Entries above MAX_WIDTH are null
+    WriteFn write[65];
+    ReadFn read[65];
+};
+
+template<typename T, int N>
+struct Fill {
+    static void run(Table<T>& table) {
+        table.write[N] = &Kernel<T, N>::write;
+        table.read[N] = &Kernel<T, N>::read;
+        Fill<T, N - 1>::run(table);
+    }
+};
+
+template<typename T>
+struct Fill<T, -1> {
+    static void run(Table<T>&) {
+    }
+};
+
+template<typename T>
+Table<T> make_table() {
+    Table<T> table = {};
+    Fill<T, Table<T>::MAX_WIDTH>::run(table);
+    return table;
+}
+
+//! Group kernels for widths 0 to 8*sizeof(T)
+template<typename T>
+const Table<T>& table() {
+    static const Table<T> instance = make_table<T>();
+    return instance;
+}
+
+//! Set or clear `count` bits of the LSB-first bitmap starting at bit `offset`
+inline void set_bits(u8* bitmap, u64 offset, u64 count, bool value) {
+    for (; count && offset % 8; offset++, count--) {
+        bitmap[offset / 8] = static_cast<u8>((bitmap[offset / 8] & ~(1u << offset % 8)) | (value << offset % 8));
+    }
+    std::memset(bitmap + offset / 8, value ? 0xFF : 0, count / 8);
+    offset += count / 8 * 8;
+    for (count %= 8; count; offset++, count--) {
+        bitmap[offset / 8] = static_cast<u8>((bitmap[offset / 8] & ~(1u << offset % 8)) | (value << offset % 8));
+    }
+}
+
+//! Number of set bits in `size` bytes
+inline u64 count_bits(const u8* input, size_t size) {
+    u64 count = 0;
+    for (; size >= 8; input += 8, size -= 8) {
+        u64 word;
+        std::memcpy(&word, input, sizeof(word));
+        count += __builtin_popcountll(word);
+    }
+    for (; size; input++, size--) {
+        count += __builtin_popcount(*input);
+    }
+    return count;
+}
+
+}  // namespace parquet
+
+/** Writes the Parquet hybrid encoding of `width`-bit values to any sink
+  * with `allocate` (MemoryStream, GrowableSink, ...). Runs of MIN_RUN or
+  * more equal values become repeated runs, everything else is bit-packed.
+  */
+template<class Stream = MemoryStream>
+class BasicParquetEncoder {
+    Stream& stream_;
+    int width_;
+
+    template<typename T>
+    bool _put_literal(const T* input, size_t count) {
+        const size_t groups = (count + 7) / 8;
+        if (!rle::put_varint(stream_, groups << 1 | 1)) {
+            return false;
+        }
+        u8* out = stream_.allocate(groups*width_);
+        if (!out) {
+            return false;
+        }
+        const typename parquet::Table<T>::WriteFn write = parquet::table<T>().write[width_];
+        for (; count >= 8; input += 8, count -= 8, out += width_) {
+            write(input, out);
+        }
+        if (count) {
+            T padded[8] = {};
+            std::copy(input, input + count, padded);
+            write(padded, out);
+        }
+        return true;
+    }
+
+    template<typename T>
+    bool _put_run(T value, size_t count) {
+        if (!rle::put_varint(stream_, count << 1)) {
+            return false;
+        }
+        const u64 bits = static_cast<typename std::make_unsigned<T>::type>(value);
+        u8* out = stream_.allocate((width_ + 7) / 8);
+        if (!out) {
+            return false;
+        }
+        std::memcpy(out, &bits, (width_ + 7) / 8);
+        return true;
+    }
+public:
+    BasicParquetEncoder(Stream& stream, int width)
+        : stream_(stream)
+        , width_(width)
+    {
+        if (width < 0 || width > 64) {
+            throw std::invalid_argument("Invalid bit width");
+        }
+    }
+
+    //! Worst case size of `count` values of `width` bits in bytes
+    static size_t max_size(size_t count, int width) {
+        return (count / parquet::MIN_RUN + 1) * (2*rle::MAX_VARINT_SIZE + 8) + (count + 7) / 8 * width;
+    }
+
+    /** Encode `count` values, every value should fit in `width` bits.
+      * Bit-packed runs are extended into the following repeated run to
+      * whole groups, only the last group of the stream is zero-padded.
+      * Returns false if the stream is full.
+      */
+    template<typename T>
+    bool encode(const T* input, size_t count) {
+        if (width_ > parquet::Table<T>::MAX_WIDTH) {
+            throw std::invalid_argument("Bit width is too large for the type");
+        }
+        size_t literal = 0;
+        size_t i = 0;
+        while (i < count) {
+            size_t run = rle::run_length(input + i, count - i);
+            const size_t align = (8 - (i - literal) % 8) % 8;
+            if (run >= parquet::MIN_RUN + align) {
+                i += align;
+                run -= align;
+                if (i > literal && !_put_literal(input + literal, i - literal)) {
+                    return false;
+                }
+                if (!_put_run(input[i], run)) {
+                    return false;
+                }
+                i += run;
+                literal = i;
+            } else {
+                i += run;
+            }
+        }
+        return literal == count || _put_literal(input + literal, count - literal);
+    }
+};
+
+typedef BasicParquetEncoder<MemoryStream> ParquetEncoder;
+
+/** Reads the Parquet hybrid encoding from memory owned by the caller.
+  * Decoding can stop and resume anywhere, also inside a run. Values go
+  * straight into typed value buffers, width 1 levels into an Arrow
+  * validity bitmap.
+  */
+class ParquetDecoder {
+    BufferSource source_;
+    size_t size_;
+    int width_;
+    //! Values left in the current repeated run and its value
+    u64 repeat_left_;
+    u64 repeat_value_;
+    //! Groups left in the current bit-packed run
+    u64 groups_left_;
+    //! Decoded group and position in it, 8 if empty
+    u64 group_[8];
+    int group_pos_;
+
+    //! Read the next run header, returns false at the end of the stream
+    bool _next_run() {
+        if (source_.size() == size_) {
+            return false;
+        }
+        const u64 header = rle::read_varint(source_);
+        if (header & 1) {
+            groups_left_ = header >> 1;
+        } else {
+            repeat_left_ = header >> 1;
+            repeat_value_ = 0;
+            std::memcpy(&repeat_value_, source_.consume((width_ + 7) / 8), (width_ + 7) / 8);
+        }
+        return true;
+    }
+
+    const u8* _next_group(size_t ngroups = 1) {
+        groups_left_ -= ngroups;
+        return source_.consume(ngroups*width_);
+    }
+
+    void _fill_group() {
+        parquet::table<u64>().read[width_](_next_group(), group_);
+        group_pos_ = 0;
+    }
+public:
+    ParquetDecoder(const u8* data, size_t size, int width)
+        : source_(data, size)
+        , size_(size)
+        , width_(width)
+        , repeat_left_(0)
+        , repeat_value_(0)
+        , groups_left_(0)
+        , group_pos_(8)
+    {
+        if (width < 0 || width > 64) {
+            throw std::invalid_argument("Invalid bit width");
+        }
+    }
+
+    /** Decode up to `count` values into `output`, returns number of values
+      * decoded (less than `count` only at the end of the stream).
+      */
+    template<typename T>
+    size_t decode(T* output, size_t count) {
+        if (width_ > parquet::Table<T>::MAX_WIDTH) {
+            throw std::invalid_argument("Bit width is too large for the type");
+        }
+        const typename parquet::Table<T>::ReadFn read = parquet::table<T>().read[width_];
+        size_t done = 0;
+        while (done < count) {
+            if (group_pos_ < 8) {
+                const size_t k = std::min<size_t>(8 - group_pos_, count - done);
+                for (size_t i = 0; i < k; i++) {
+                    output[done + i] = static_cast<T>(group_[group_pos_ + i]);
+                }
+                group_pos_ += static_cast<int>(k);
+                done += k;
+            } else if (repeat_left_) {
+                const size_t k = static_cast<size_t>(std::min<u64>(repeat_left_, count - done));
+                std::fill_n(output + done, k, static_cast<T>(repeat_value_));
+                repeat_left_ -= k;
+                done += k;
+            } else if (groups_left_) {
+                if (count - done < 8) {
+                    _fill_group();
+                    continue;
+                }
+                const size_t ngroups = static_cast<size_t>(std::min<u64>(groups_left_, (count - done) / 8));
+                const u8* input = _next_group(ngroups);
+                for (size_t g = 0; g < ngroups; g++, input += width_, done += 8) {
+                    read(input, output + done);
+                }
+            } else if (!_next_run()) {
+                break;
+            }
+        }
+        return done;
+    }
+
+    /** Decode up to `count` levels of width 1 into the Arrow validity
+      * bitmap from bit `offset`, returns number of levels decoded. Adds
+      * the number of set bits to `nvalid`.
+      */
+    size_t decode_validity(u8* bitmap, u64 offset, size_t count, u64* nvalid) {
+        if (width_ != 1) {
+            throw std::invalid_argument("Validity needs bit width 1");
+        }
+        size_t done = 0;
+        u64 valid = 0;
+        while (done < count) {
+            if (group_pos_ < 8) {
+                const bool bit = group_[group_pos_++] != 0;
+                parquet::set_bits(bitmap, offset + done, 1, bit);
+                valid += bit;
+                done++;
+            } else if (repeat_left_) {
+                const size_t k = static_cast<size_t>(std::min<u64>(repeat_left_, count - done));
+                parquet::set_bits(bitmap, offset + done, k, repeat_value_ != 0);
+                valid += repeat_value_ ? k : 0;
+                repeat_left_ -= k;
+                done += k;
+            } else if (groups_left_) {
+                if ((offset + done) % 8 || count - done < 8) {
+                    _fill_group();
+                    continue;
+                }
+                // groups of width 1 are bitmap bytes already
+                const size_t ngroups = static_cast<size_t>(std::min<u64>(groups_left_, (count - done) / 8));
+                const u8* input = _next_group(ngroups);
+                std::memcpy(bitmap + (offset + done) / 8, input, ngroups);
+                valid += parquet::count_bits(input, ngroups);
+                done += 8*ngroups;
+            } else if (!_next_run()) {
+                break;
+            }
+        }
+        *nvalid += valid;
+        return done;
+    }
+
+    /** Decode the values of the valid slots of an Arrow array: slot `i`
+      * of `output` gets the next value if bit `offset + i` of `validity`
+      * is set, null slots are zeroed. Returns number of values decoded,
+      * throws if the stream ends before the last valid slot.
+      */
+    template<typename T>
+    size_t decode_spaced(T* output, size_t count, const u8* validity, u64 offset) {
+        size_t nvalid = 0;
+        for (size_t i = 0; i < count; i++) {
+            nvalid += (validity[(offset + i) / 8] >> (offset + i) % 8) & 1;
+        }
+        if (decode(output, nvalid) != nvalid) {
+            throw std::out_of_range("End-Of-Stream");
+        }
+        // move values to their slots from the back, value `j` never goes below slot `j`
+        size_t j = nvalid;
+        for (size_t i = count; i-- > 0; ) {
+            output[i] = (validity[(offset + i) / 8] >> (offset + i) % 8) & 1 ? output[--j] : T();
+        }
+        return nvalid;
+    }
+};
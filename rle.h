@@ -0,0 +1,177 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+
+#include "bitpack.h"
+
+/** Run-length / bitpacking hybrid for columns with long runs of the same
+  * value (status codes, flags, slowly changing gauges). The stream is a
+  * sequence of runs, every run starts with a ULEB128 header:
+  *
+  *   `count << 1`      repeated run, followed by the ULEB128 value
+  *   `count << 1 | 1`  literal run of `count` values, ceil(count/16)
+  *                     blocks, every block is u8 width and the packed
+  *                     values, last block is zero-padded
+  *
+  * Runs shorter than MIN_RUN are kept in the literal stretch around them.
+  */
+namespace rle {
+
+enum {
+    //! Shortest run encoded as (value, count)
+    MIN_RUN = 16,
+    //! Longest ULEB128 encoding of u64
+    MAX_VARINT_SIZE = 10,
+};
+
+//! Write `value` as ULEB128, returns false if the stream is full
+template<class Stream>
+bool put_varint(Stream& stream, u64 value) {
+    u8 bytes[MAX_VARINT_SIZE];
+    size_t size = 0;
+    while (value >= 0x80) {
+        bytes[size++] = static_cast<u8>(value | 0x80);
+        value >>= 7;
+    }
+    bytes[size++] = static_cast<u8>(value);
+    u8* out = stream.allocate(size);
+    if (!out) {
+        return false;
+    }
+    std::memcpy(out, bytes, size);
+    return true;
+}
+
+//! Read ULEB128 value
+template<class Stream>
+u64 read_varint(Stream& stream) {
+    u64 value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const u8 byte = *stream.consume(1);
+        value |= static_cast<u64>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw std::out_of_range("Corrupted stream");
+}
+
+//! Length of the run of equal values starting at `input`, at most `count`
+template<typename T>
+size_t run_length(const T* input, size_t count) {
+    size_t i = 1;
+    while (i < count && input[i] == input[0]) {
+        i++;
+    }
+    return i;
+}
+
+}  // namespace rle
+
+class RleEncoder {
+    MemoryStream &stream_;
+    const KernelTable& kernels_;
+
+    bool _pack_literal(const u64* input, size_t count) {
+        if (!rle::put_varint(stream_, count << 1 | 1)) {
+            return false;
+        }
+        for (; count; input += std::min<size_t>(count, 16), count -= std::min<size_t>(count, 16)) {
+            u64 padded[16] = {};
+            const u64* block = input;
+            if (count < 16) {
+                std::copy(input, input + count, padded);
+                block = padded;
+            }
+            const int n = get_block_width(block);
+            u8* width = stream_.allocate(1);
+            if (!width) {
+                return false;
+            }
+            *width = static_cast<u8>(n);
+            if (!kernels_.pack[n](stream_, block)) {
+                return false;
+            }
+        }
+        return true;
+    }
+public:
+    RleEncoder(MemoryStream& stream, const KernelTable& kernels = best_kernels())
+        : stream_(stream)
+        , kernels_(kernels)
+    {
+    }
+
+    //! Worst case size of `count` values in bytes
+    static size_t max_size(size_t count) {
+        return rle::MAX_VARINT_SIZE + (count + 15) / 16 * 129;
+    }
+
+    /** Pack `count` values, returns false if the stream is full. Literal
+      * stretches are extended into the following run to a multiple of 16
+      * values when the run stays long enough, so only the last block of
+      * the stream needs padding.
+      */
+    bool pack(const u64* input, size_t count) {
+        size_t literal = 0;
+        size_t i = 0;
+        while (i < count) {
+            size_t run = rle::run_length(input + i, count - i);
+            const size_t align = (16 - (i - literal) % 16) % 16;
+            if (run >= rle::MIN_RUN + align) {
+                i += align;
+                run -= align;
+                if (i > literal && !_pack_literal(input + literal, i - literal)) {
+                    return false;
+                }
+                if (!rle::put_varint(stream_, run << 1) || !rle::put_varint(stream_, input[i])) {
+                    return false;
+                }
+                i += run;
+                literal = i;
+            } else {
+                i += run;
+            }
+        }
+        return literal == count || _pack_literal(input + literal, count - literal);
+    }
+
+    //! Unpack `count` values written by one `pack` call, output is overwritten
+    void unpack(u64* output, size_t count) {
+        while (count) {
+            const u64 header = rle::read_varint(stream_);
+            const u64 length = header >> 1;
+            if (length == 0 || length > count) {
+                throw std::out_of_range("Corrupted stream");
+            }
+            if (!(header & 1)) {
+                // vectorized by the compiler into wide stores
+                std::fill_n(output, length, rle::read_varint(stream_));
+                output += length;
+                count -= length;
+                continue;
+            }
+            for (u64 left = length; left; ) {
+                const int n = *stream_.consume(1);
+                if (n > 64) {
+                    throw std::out_of_range("Invalid bit width");
+                }
+                if (left >= 16) {
+                    if (!kernels_.unpack[n](stream_, output)) {
+                        throw std::out_of_range("End-Of-Stream");
+                    }
+                    output += 16;
+                    left -= 16;
+                } else {
+                    u64 block[16];
+                    if (!kernels_.unpack[n](stream_, block)) {
+                        throw std::out_of_range("End-Of-Stream");
+                    }
+                    output = std::copy(block, block + left, output);
+                    left = 0;
+                }
+            }
+            count -= length;
+        }
+    }
+};
@@ -0,0 +1,277 @@
+#pragma once
+#include <cstring>
+#include <type_traits>
+
+#include "stream.h"
+
+//! Lowest N bits set
+template<int N>
+struct Mask {
+    static const u64 value = ~0ull >> (64 - N);
+};
+
+template<>
+struct Mask<0> {
+    static const u64 value = 0;
+};
+
+//! Policy of BlockKernel::decode, writes values to the output
+struct Store {
+    u64* output;
+
+    explicit Store(u64* output)
+        : output(output)
+    {
+    }
+
+    void operator () (int i, u64 value) {
+        output[i] = value;
+    }
+};
+
+/** Policy of BlockKernel::decode, collects values narrower than 8 bits
+  * as bytes of two words, so they are stored with two wide writes.
+  */
+struct CollectBytes {
+    u64 words[2];
+
+    CollectBytes()
+        : words()
+    {
+    }
+
+    void operator () (int i, u64 value) {
+        words[i / 8] |= value << 8*(i % 8);
+    }
+};
+
+//! Policy of BlockKernel::decode, ORs values into the output shifted left by `shift` bits
+struct OrShifted {
+    u64* output;
+    int shift;
+
+    OrShifted(u64* output, int shift)
+        : output(output)
+        , shift(shift)
+    {
+    }
+
+    void operator () (int i, u64 value) {
+        output[i] |= value << shift;
+    }
+};
+
+/** Fused kernel for the 16-value block layout of width N. Block is
+  * split into 32, 16 and 8-bit planes (each plane stores 16 values) and a
+  * tail of `N % 8` bits per value packed LSB-first into `2*(N % 8)` bytes,
+  * width 64 is stored as is. The kernel reads every input value once and
+  * writes every output word once, the loop is fully unrolled.
+  */
+template<int N>
+struct BlockKernel {
+    enum {
+        //! Encoded block size in bytes
+        SIZE = 2*N,
+        HAS32 = N >= 32 && N < 64,
+        HAS16 = N < 64 && N % 32 >= 16,
+        HAS8 = N < 64 && N % 16 >= 8,
+        TAIL = N < 64 ? N % 8 : 0,
+        OFFSET16 = 64*HAS32,
+        OFFSET8 = OFFSET16 + 32*HAS16,
+        OFFSET_TAIL = OFFSET8 + 16*HAS8,
+        SHIFT16 = 32*HAS32,
+        SHIFT8 = SHIFT16 + 16*HAS16,
+        SHIFT_TAIL = SHIFT8 + 8*HAS8,
+    };
+
+    //! Encode the block, `T` is any integer type wide enough for N bits
+    template<typename T>
+    static void write(const T* input, u8* output) {
+        typedef typename std::make_unsigned<T>::type U;
+        if (N == 64 && sizeof(T) == 8) {
+            std::memcpy(output, input, 128);
+            return;
+        }
+        u64 tail[2] = {};
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) {
+            const u64 value = static_cast<U>(input[i]);
+            if (HAS32 != 0) {
+                const u32 bits = static_cast<u32>(value);
+                std::memcpy(output + 4*i, &bits, sizeof(bits));
+            }
+            if (HAS16 != 0) {
+                const u16 bits = static_cast<u16>(value >> SHIFT16);
+                std::memcpy(output + OFFSET16 + 2*i, &bits, sizeof(bits));
+            }
+            if (HAS8 != 0) {
+                output[OFFSET8 + i] = static_cast<u8>(value >> SHIFT8);
+            }
+            if (TAIL != 0) {
+                const u64 bits = (value >> SHIFT_TAIL) & Mask<TAIL>::value;
+                const int pos = i*TAIL;
+                tail[pos / 64] |= bits << (pos % 64);
+                if (pos % 64 + TAIL > 64) {
+                    tail[1] |= bits >> ((64 - pos % 64) & 63);
+                }
+            }
+        }
+        if (TAIL != 0) {
+            std::memcpy(output + OFFSET_TAIL, tail, 2*TAIL);
+        }
+    }
+
+    //! Decode the block, output is overwritten
+    static void read(const u8* input, u64* output) {
+        Store op(output);
+        decode(input, op);
+    }
+
+    /** Decode the block into the output shifted left by `shift` bits.
+      * The lowest chunk (`shift == 0`) overwrites the output, higher
+      * chunks are ORed into it.
+      */
+    static void read(const u8* input, u64* output, int shift) {
+        if (shift == 0) {
+            read(input, output);
+        } else {
+            OrShifted op(output, shift);
+            decode(input, op);
+        }
+    }
+
+    //! Decode the block, every value is handed to `op(i, value)`
+    template<class Op>
+    static void decode(const u8* input, Op& op) {
+        u64 tail[2] = {};
+        if (TAIL != 0) {
+            std::memcpy(tail, input + OFFSET_TAIL, 2*TAIL);
+        }
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) {
+            u64 value = 0;
+            if (N == 64) {
+                std::memcpy(&value, input + 8*i, sizeof(value));
+            }
+            if (HAS32 != 0) {
+                u32 bits;
+                std::memcpy(&bits, input + 4*i, sizeof(bits));
+                value |= bits;
+            }
+            if (HAS16 != 0) {
+                u16 bits;
+                std::memcpy(&bits, input + OFFSET16 + 2*i, sizeof(bits));
+                value |= static_cast<u64>(bits) << SHIFT16;
+            }
+            if (HAS8 != 0) {
+                value |= static_cast<u64>(input[OFFSET8 + i]) << SHIFT8;
+            }
+            if (TAIL != 0) {
+                const int pos = i*TAIL;
+                u64 bits = tail[pos / 64] >> (pos % 64);
+                if (pos % 64 + TAIL > 64) {
+                    bits |= tail[1] << ((64 - pos % 64) & 63);
+                }
+                value |= (bits & Mask<TAIL>::value) << SHIFT_TAIL;
+            }
+            op(i, value);
+        }
+    }
+
+    static bool pack(MemoryStream& stream, const u64* input) {
+        u8* out = stream.allocate(SIZE);
+        if (!out) {
+            return false;
+        }
+        write(input, out);
+        return true;
+    }
+
+    //! Returns false if the stream is too short
+    static bool unpack(MemoryStream& stream, u64* output) {
+        const u8* in = stream.try_consume(SIZE);
+        if (!in) {
+            return false;
+        }
+        read(in, output);
+        return true;
+    }
+};
+
+/** Plane kernels, building blocks for the SIMD kernel sets (see simd.h).
+  * `_packTail<R>` and `_unpackTail<R>` handle the `R < 8` bit tail.
+  * Pack kernels take the chunk starting at bit `shift` of every value
+  * and never modify the input. Kernels read and write raw plane
+  * pointers, the stream is checked once per block by the caller.
+  * `_read<N>` combines every plane of a value in registers and stores
+  * it once, the tail is decoded to one byte per value beforehand.
+  */
+struct ScalarKernels {
+    static const char* name() {
+        return "scalar";
+    }
+
+    //! Pack the `T`-sized chunk of every value starting at bit `shift`
+    template<typename T>
+    static void _packN(const u64* input, u8* out, int shift) {
+        for (int i = 0; i < 16; i++) {
+            const T bits = static_cast<T>(input[i] >> shift);
+            std::memcpy(out + i*sizeof(T), &bits, sizeof(bits));
+        }
+    }
+
+    //! Value `i` of the `T`-sized plane
+    template <typename T>
+    static u64 _unpack1(const u8* in, int i) {
+        T val;
+        std::memcpy(&val, in + i*sizeof(T), sizeof(val));
+        return val;
+    }
+
+    //! Decode the block of width N, `tail` holds the tail bits of every value
+    template<int N>
+    static void _read(const u8* in, const u8* tail, u64* output) {
+        typedef BlockKernel<N> K;
+        for (int i = 0; i < 16; i++) {
+            u64 value = 0;
+            if (N == 64) {
+                value = _unpack1<u64>(in, i);
+            }
+            if (K::HAS32 != 0) {
+                value = _unpack1<u32>(in, i);
+            }
+            if (K::HAS16 != 0) {
+                value |= _unpack1<u16>(in + K::OFFSET16, i) << K::SHIFT16;
+            }
+            if (K::HAS8 != 0) {
+                value |= _unpack1<u8>(in + K::OFFSET8, i) << K::SHIFT8;
+            }
+            if (K::TAIL != 0) {
+                value |= _unpack1<u8>(tail, i) << K::SHIFT_TAIL;
+            }
+            output[i] = value;
+        }
+    }
+
+    //! Byte of every value starting at bit `shift`
+    static void _narrow8(const u64* input, u8* output, int shift) {
+        for (int i = 0; i < 16; i++) {
+            output[i] = static_cast<u8>(input[i] >> shift);
+        }
+    }
+
+    template<int R>
+    static void _packTail(const u64* input, u8* out, int shift) {
+        u8 bytes[16];
+        _narrow8(input, bytes, shift);
+        BlockKernel<R>::write(bytes, out);
+    }
+
+    //! Decode the R-bit tail to one byte per value
+    template<int R>
+    static void _unpackTail(const u8* in, u8* bytes) {
+        CollectBytes op;
+        BlockKernel<R>::decode(in, op);
+        std::memcpy(bytes, op.words, sizeof(op.words));
+    }
+};
@@ -0,0 +1,191 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
+#include "bitpack.h"
+#include "bmi2.h"
+#include "cpu.h"
+
+/** Range predicate `lo <= v <= hi` evaluated on blocks packed by
+  * Encoder::pack. Result is a selection bitmap, bit `i % 8` of byte
+  * `i / 8` is set if value `i` matches (two bytes per block).
+  */
+namespace scan {
+
+//! Policy of BlockKernel::decode, sets bit `i` if the value is in range
+struct InRange {
+    u64 lo;
+    u64 span;
+    u32 bits;
+
+    void operator () (int i, u64 value) {
+        bits |= static_cast<u32>(value - lo <= span) << i;
+    }
+};
+
+typedef void (*ScanFn)(const u8* input, size_t nblocks, u64 lo, u64 hi, u8* bitmap);
+
+template<int N>
+struct Scalar {
+    static void run(const u8* input, size_t nblocks, u64 lo, u64 hi, u8* bitmap) {
+        for (size_t b = 0; b < nblocks; b++) {
+            InRange op = { lo, hi - lo, 0 };
+            BlockKernel<N>::decode(input + b*BlockKernel<N>::SIZE, op);
+            const u16 bits = static_cast<u16>(op.bits);
+            std::memcpy(bitmap + 2*b, &bits, sizeof(bits));
+        }
+    }
+};
+
+/** Compares every plane at its own width (32, 16 and 8-bit lanes, the
+  * tail is spread to bytes with PDEP), from the most significant part
+  * down, and combines the per-plane masks lexicographically.
+  */
+template<int N>
+struct Avx512 {
+    typedef BlockKernel<N> K;
+
+    BITPACK_AVX512BW static void run(const u8* input, size_t nblocks, u64 lo, u64 hi, u8* bitmap) {
+        if (N == 64) {
+            const __m512i clo = _mm512_set1_epi64(static_cast<i64>(lo));
+            const __m512i chi = _mm512_set1_epi64(static_cast<i64>(hi));
+            for (size_t b = 0; b < nblocks; b++) {
+                const u8* block = input + b*K::SIZE;
+                const __m512i v0 = _mm512_loadu_si512(block);
+                const __m512i v1 = _mm512_loadu_si512(block + 64);
+                const __mmask8 m0 = _mm512_mask_cmple_epu64_mask(_mm512_cmpge_epu64_mask(v0, clo), v0, chi);
+                const __mmask8 m1 = _mm512_mask_cmple_epu64_mask(_mm512_cmpge_epu64_mask(v1, clo), v1, chi);
+                const u16 bits = static_cast<u16>(m0 | (m1 << 8));
+                std::memcpy(bitmap + 2*b, &bits, sizeof(bits));
+            }
+            return;
+        }
+        const __m512i lo32 = _mm512_set1_epi32(static_cast<i32>(lo));
+        const __m512i hi32 = _mm512_set1_epi32(static_cast<i32>(hi));
+        const __m256i lo16 = _mm256_set1_epi16(static_cast<i16>(lo >> K::SHIFT16));
+        const __m256i hi16 = _mm256_set1_epi16(static_cast<i16>(hi >> K::SHIFT16));
+        const __m128i lo8 = _mm_set1_epi8(static_cast<char>(lo >> K::SHIFT8));
+        const __m128i hi8 = _mm_set1_epi8(static_cast<char>(hi >> K::SHIFT8));
+        const __m128i lotail = _mm_set1_epi8(static_cast<char>((lo >> (K::SHIFT_TAIL & 63)) & Mask<K::TAIL>::value));
+        const __m128i hitail = _mm_set1_epi8(static_cast<char>((hi >> (K::SHIFT_TAIL & 63)) & Mask<K::TAIL>::value));
+        for (size_t b = 0; b < nblocks; b++) {
+            const u8* block = input + b*K::SIZE;
+            // values above `lo` and below `hi` so far, equal to them so far
+            __mmask16 gt = 0, lt = 0, eqlo = 0xFFFF, eqhi = 0xFFFF;
+            if (K::TAIL != 0) {
+                u64 words[2] = {};
+                std::memcpy(words, block + K::OFFSET_TAIL, 2*K::TAIL);
+                const u64 first = words[0] & Mask<8*K::TAIL>::value;
+                const u64 second = (words[0] >> ((8*K::TAIL) & 63)) | (words[1] << ((64 - 8*K::TAIL) & 63));
+                const __m128i v = _mm_set_epi64x(static_cast<i64>(_pdep_u64(second, BMI2_MASKS[K::TAIL])),
+                                                 static_cast<i64>(_pdep_u64(first, BMI2_MASKS[K::TAIL])));
+                gt = _mm_cmpgt_epu8_mask(v, lotail);
+                lt = _mm_cmplt_epu8_mask(v, hitail);
+                eqlo = _mm_cmpeq_epu8_mask(v, lotail);
+                eqhi = _mm_cmpeq_epu8_mask(v, hitail);
+            }
+            if (K::HAS8 != 0) {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + K::OFFSET8));
+                gt |= _mm_mask_cmpgt_epu8_mask(eqlo, v, lo8);
+                lt |= _mm_mask_cmplt_epu8_mask(eqhi, v, hi8);
+                eqlo = _mm_mask_cmpeq_epu8_mask(eqlo, v, lo8);
+                eqhi = _mm_mask_cmpeq_epu8_mask(eqhi, v, hi8);
+            }
+            if (K::HAS16 != 0) {
+                const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + K::OFFSET16));
+                gt |= _mm256_mask_cmpgt_epu16_mask(eqlo, v, lo16);
+                lt |= _mm256_mask_cmplt_epu16_mask(eqhi, v, hi16);
+                eqlo = _mm256_mask_cmpeq_epu16_mask(eqlo, v, lo16);
+                eqhi = _mm256_mask_cmpeq_epu16_mask(eqhi, v, hi16);
+            }
+            if (K::HAS32 != 0) {
+                const __m512i v = _mm512_loadu_si512(block);
+                gt |= _mm512_mask_cmpgt_epu32_mask(eqlo, v, lo32);
+                lt |= _mm512_mask_cmplt_epu32_mask(eqhi, v, hi32);
+                eqlo = _mm512_mask_cmpeq_epu32_mask(eqlo, v, lo32);
+                eqhi = _mm512_mask_cmpeq_epu32_mask(eqhi, v, hi32);
+            }
+            const u16 bits = static_cast<u16>((gt | eqlo) & (lt | eqhi));
+            std::memcpy(bitmap + 2*b, &bits, sizeof(bits));
+        }
+    }
+};
+
+struct ScanTable {
+    const char* name;
+    ScanFn scan[65];
+};
+
+template<template<int> class Impl, int N>
+struct Fill {
+    static void run(ScanTable& table) {
+        table.scan[N] = &Impl<N>::run;
+        Fill<Impl, N - 1>::run(table);
+    }
+};
+
+template<template<int> class Impl>
+struct Fill<Impl, -1> {
+    static void run(ScanTable&) {
+    }
+};
+
+template<template<int> class Impl>
+ScanTable make_table(const char* name) {
+    ScanTable table;
+    table.name = name;
+    Fill<Impl, 64>::run(table);
+    return table;
+}
+
+inline const ScanTable& scalar_table() {
+    static const ScanTable table = make_table<Scalar>("scalar");
+    return table;
+}
+
+inline const ScanTable& avx512_table() {
+    static const ScanTable table = make_table<Avx512>("avx512");
+    return table;
+}
+
+inline const ScanTable& best_table() {
+    const CpuFeatures& cpu = cpu_features();
+    if (cpu.avx512bw && cpu.avx512vl && cpu.bmi2) {
+        return avx512_table();
+    }
+    return scalar_table();
+}
+
+}  // namespace scan
+
+class Scanner {
+    MemoryStream &stream_;
+    const scan::ScanTable& table_;
+public:
+    Scanner(MemoryStream& stream, const scan::ScanTable& table = scan::best_table())
+        : stream_(stream)
+        , table_(table)
+    {
+    }
+
+    /** Scan `nblocks` blocks of width `n` for values in [lo, hi], writes
+      * `2*nblocks` bytes of the selection bitmap.
+      */
+    void scan_range(int n, size_t nblocks, u64 lo, u64 hi, u8* bitmap) {
+        if (n < 0 || n > 64) {
+            throw std::out_of_range("Invalid bit width");
+        }
+        const u8* input = stream_.consume(2*n*nblocks);
+        const u64 max = n == 64 ? ~0ull : (1ull << n) - 1;
+        if (lo > hi || lo > max) {
+            std::fill(bitmap, bitmap + 2*nblocks, 0);
+            return;
+        }
+        table_.scan[n](input, nblocks, lo, std::min(hi, max), bitmap);
+    }
+
+    void scan_equal(int n, size_t nblocks, u64 value, u8* bitmap) {
+        scan_range(n, nblocks, value, value, bitmap);
+    }
+};
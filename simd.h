@@ -0,0 +1,391 @@
+#pragma once
+#include <cstring>
+#include <immintrin.h>
+
+#include "cpu.h"
+#include "scalar.h"
+
+/** SIMD versions of the plane kernels. Every struct overrides the kernels
+  * it can speed up and inherits the rest, output is byte-for-byte
+  * identical to ScalarKernels.
+  */
+
+struct Sse41Kernels : ScalarKernels {
+    static const char* name() {
+        return "sse4.1";
+    }
+
+    //! 32 bits of four values starting at bit `shift`
+    BITPACK_SSE41 static __m128i _narrow32(const u64* input, __m128i shift) {
+        const __m128i a = _mm_srl_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input)), shift);
+        const __m128i b = _mm_srl_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2)), shift);
+        const __m128 lo = _mm_castsi128_ps(a);
+        const __m128 hi = _mm_castsi128_ps(b);
+        return _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+    }
+
+    BITPACK_SSE41 static void _pack64(const u64* input, u8* out) {
+        std::memcpy(out, input, 128);
+    }
+
+    BITPACK_SSE41 static void _pack32(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(shift);
+        for (int i = 0; i < 16; i += 4) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4*i), _narrow32(input + i, cnt));
+        }
+    }
+
+    BITPACK_SSE41 static void _pack16(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(shift);
+        const __m128i mask = _mm_set1_epi32(0xFFFF);
+        for (int i = 0; i < 16; i += 8) {
+            const __m128i a = _mm_and_si128(_narrow32(input + i, cnt), mask);
+            const __m128i b = _mm_and_si128(_narrow32(input + i + 4, cnt), mask);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2*i), _mm_packus_epi32(a, b));
+        }
+    }
+
+    //! Byte of every value starting at bit `shift`
+    BITPACK_SSE41 static void _narrow8(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(shift);
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        const __m128i a = _mm_and_si128(_narrow32(input, cnt), mask);
+        const __m128i b = _mm_and_si128(_narrow32(input + 4, cnt), mask);
+        const __m128i c = _mm_and_si128(_narrow32(input + 8, cnt), mask);
+        const __m128i d = _mm_and_si128(_narrow32(input + 12, cnt), mask);
+        const __m128i bytes = _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), bytes);
+    }
+
+    template<typename T>
+    BITPACK_SSE41 static void _packN(const u64* input, u8* out, int shift) {
+        switch (sizeof(T)) {
+        case 1:
+            _narrow8(input, out, shift);
+            return;
+        case 2:
+            _pack16(input, out, shift);
+            return;
+        case 4:
+            _pack32(input, out, shift);
+            return;
+        }
+        _pack64(input, out);
+    }
+
+    //! Values `i` and `i + 1` of the `T`-sized plane
+    template<typename T>
+    BITPACK_SSE41 static __m128i _unpack2(const u8* in, int i) {
+        const u8* src = in + i*sizeof(T);
+        switch (sizeof(T)) {
+        case 1: {
+            u16 bits;
+            std::memcpy(&bits, src, sizeof(bits));
+            return _mm_cvtepu8_epi64(_mm_cvtsi32_si128(bits));
+        }
+        case 2: {
+            u32 bits;
+            std::memcpy(&bits, src, sizeof(bits));
+            return _mm_cvtepu16_epi64(_mm_cvtsi32_si128(static_cast<int>(bits)));
+        }
+        case 4:
+            return _mm_cvtepu32_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)));
+        }
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    }
+
+    //! Decode the block of width N, `tail` holds the tail bits of every value
+    template<int N>
+    BITPACK_SSE41 static void _read(const u8* in, const u8* tail, u64* output) {
+        typedef BlockKernel<N> K;
+        for (int i = 0; i < 16; i += 2) {
+            __m128i value = _mm_setzero_si128();
+            if (N == 64) {
+                value = _unpack2<u64>(in, i);
+            }
+            if (K::HAS32 != 0) {
+                value = _unpack2<u32>(in, i);
+            }
+            if (K::HAS16 != 0) {
+                value = _mm_or_si128(value, _mm_slli_epi64(_unpack2<u16>(in + K::OFFSET16, i), K::SHIFT16));
+            }
+            if (K::HAS8 != 0) {
+                value = _mm_or_si128(value, _mm_slli_epi64(_unpack2<u8>(in + K::OFFSET8, i), K::SHIFT8));
+            }
+            if (K::TAIL != 0) {
+                value = _mm_or_si128(value, _mm_slli_epi64(_unpack2<u8>(tail, i), K::SHIFT_TAIL));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), value);
+        }
+    }
+
+    //! Bit `shift` of every value moved to the sign bit
+    BITPACK_SSE41 static void _pack1(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(63 - shift);
+        u16 bits = 0;
+        for (int i = 0; i < 16; i += 2) {
+            const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+            bits |= static_cast<u16>(_mm_movemask_pd(_mm_castsi128_pd(_mm_sll_epi64(value, cnt))) << i);
+        }
+        std::memcpy(out, &bits, sizeof(bits));
+    }
+    template<int R>
+    BITPACK_SSE41 static void _packTail(const u64* input, u8* out, int shift) {
+        if (R == 1) {
+            _pack1(input, out, shift);
+            return;
+        }
+        ScalarKernels::_packTail<R>(input, out, shift);
+    }
+
+    //! Bit `i` of the 1-bit tail to byte `i`
+    BITPACK_SSE41 static void _spread1(const u8* in, u8* bytes) {
+        u16 word;
+        std::memcpy(&word, in, sizeof(word));
+        const __m128i spread = _mm_shuffle_epi8(_mm_cvtsi32_si128(word),
+                                                _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1));
+        const __m128i bit = _mm_set1_epi64x(static_cast<i64>(0x8040201008040201ull));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes),
+                         _mm_min_epu8(_mm_and_si128(spread, bit), _mm_set1_epi8(1)));
+    }
+
+    template<int R>
+    BITPACK_SSE41 static void _unpackTail(const u8* in, u8* bytes) {
+        if (R == 1) {
+            _spread1(in, bytes);
+            return;
+        }
+        ScalarKernels::_unpackTail<R>(in, bytes);
+    }
+};
+
+struct Avx2Kernels : Sse41Kernels {
+    static const char* name() {
+        return "avx2";
+    }
+
+    //! 32 bits of eight values starting at bit `shift`
+    BITPACK_AVX2 static __m256i _narrow32x8(const u64* input, __m128i shift) {
+        const __m256i idx = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+        const __m256i lo = _mm256_permutevar8x32_epi32(
+                    _mm256_srl_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input)), shift), idx);
+        const __m256i hi = _mm256_permutevar8x32_epi32(
+                    _mm256_srl_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + 4)), shift), idx);
+        return _mm256_permute2x128_si256(lo, hi, 0x20);
+    }
+
+    BITPACK_AVX2 static void _pack32(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(shift);
+        for (int i = 0; i < 16; i += 8) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4*i), _narrow32x8(input + i, cnt));
+        }
+    }
+
+    BITPACK_AVX2 static void _pack16(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(shift);
+        const __m256i mask = _mm256_set1_epi32(0xFFFF);
+        const __m256i a = _mm256_and_si256(_narrow32x8(input, cnt), mask);
+        const __m256i b = _mm256_and_si256(_narrow32x8(input + 8, cnt), mask);
+        // packus works within 128-bit lanes, restore the order afterwards
+        const __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), words);
+    }
+
+    //! Byte of every value starting at bit `shift`
+    BITPACK_AVX2 static void _narrow8(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(shift);
+        const __m256i mask = _mm256_set1_epi32(0xFF);
+        const __m256i a = _mm256_and_si256(_narrow32x8(input, cnt), mask);
+        const __m256i b = _mm256_and_si256(_narrow32x8(input + 8, cnt), mask);
+        const __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(bytes));
+    }
+
+    template<typename T>
+    BITPACK_AVX2 static void _packN(const u64* input, u8* out, int shift) {
+        switch (sizeof(T)) {
+        case 1:
+            _narrow8(input, out, shift);
+            return;
+        case 2:
+            _pack16(input, out, shift);
+            return;
+        case 4:
+            _pack32(input, out, shift);
+            return;
+        }
+        _pack64(input, out);
+    }
+
+    //! Values `i` to `i + 3` of the `T`-sized plane
+    template<typename T>
+    BITPACK_AVX2 static __m256i _unpack4(const u8* in, int i) {
+        const u8* src = in + i*sizeof(T);
+        switch (sizeof(T)) {
+        case 1: {
+            u32 bits;
+            std::memcpy(&bits, src, sizeof(bits));
+            return _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(static_cast<int>(bits)));
+        }
+        case 2:
+            return _mm256_cvtepu16_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)));
+        case 4:
+            return _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+        }
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    }
+
+    //! Decode the block of width N, `tail` holds the tail bits of every value
+    template<int N>
+    BITPACK_AVX2 static void _read(const u8* in, const u8* tail, u64* output) {
+        typedef BlockKernel<N> K;
+        for (int i = 0; i < 16; i += 4) {
+            __m256i value = _mm256_setzero_si256();
+            if (N == 64) {
+                value = _unpack4<u64>(in, i);
+            }
+            if (K::HAS32 != 0) {
+                value = _unpack4<u32>(in, i);
+            }
+            if (K::HAS16 != 0) {
+                value = _mm256_or_si256(value, _mm256_slli_epi64(_unpack4<u16>(in + K::OFFSET16, i), K::SHIFT16));
+            }
+            if (K::HAS8 != 0) {
+                value = _mm256_or_si256(value, _mm256_slli_epi64(_unpack4<u8>(in + K::OFFSET8, i), K::SHIFT8));
+            }
+            if (K::TAIL != 0) {
+                value = _mm256_or_si256(value, _mm256_slli_epi64(_unpack4<u8>(tail, i), K::SHIFT_TAIL));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), value);
+        }
+    }
+
+    BITPACK_AVX2 static void _pack1(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(63 - shift);
+        u16 bits = 0;
+        for (int i = 0; i < 16; i += 4) {
+            const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+            bits |= static_cast<u16>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_sll_epi64(value, cnt))) << i);
+        }
+        std::memcpy(out, &bits, sizeof(bits));
+    }
+
+    template<int R>
+    BITPACK_AVX2 static void _packTail(const u64* input, u8* out, int shift) {
+        if (R == 1) {
+            _pack1(input, out, shift);
+            return;
+        }
+        ScalarKernels::_packTail<R>(input, out, shift);
+    }
+};
+
+struct Avx512Kernels : Avx2Kernels {
+    static const char* name() {
+        return "avx512";
+    }
+
+    //! Eight values shifted right by `shift` bits
+    BITPACK_AVX512 static __m512i _load8(const u64* input, __m128i shift) {
+        return _mm512_srl_epi64(_mm512_loadu_si512(input), shift);
+    }
+
+    BITPACK_AVX512 static void _pack32(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(shift);
+        for (int i = 0; i < 16; i += 8) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4*i),
+                                _mm512_cvtepi64_epi32(_load8(input + i, cnt)));
+        }
+    }
+
+    BITPACK_AVX512 static void _pack16(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(shift);
+        for (int i = 0; i < 16; i += 8) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2*i),
+                             _mm512_cvtepi64_epi16(_load8(input + i, cnt)));
+        }
+    }
+
+    //! Byte of every value starting at bit `shift`
+    BITPACK_AVX512 static void _narrow8(const u64* input, u8* out, int shift) {
+        const __m128i cnt = _mm_cvtsi32_si128(shift);
+        for (int i = 0; i < 16; i += 8) {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i),
+                             _mm512_cvtepi64_epi8(_load8(input + i, cnt)));
+        }
+    }
+
+    template<typename T>
+    BITPACK_AVX512 static void _packN(const u64* input, u8* out, int shift) {
+        switch (sizeof(T)) {
+        case 1:
+            _narrow8(input, out, shift);
+            return;
+        case 2:
+            _pack16(input, out, shift);
+            return;
+        case 4:
+            _pack32(input, out, shift);
+            return;
+        }
+        _pack64(input, out);
+    }
+
+    //! Values `i` to `i + 7` of the `T`-sized plane
+    template<typename T>
+    BITPACK_AVX512 static __m512i _unpack8(const u8* in, int i) {
+        const u8* src = in + i*sizeof(T);
+        switch (sizeof(T)) {
+        case 1:
+            return _mm512_cvtepu8_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)));
+        case 2:
+            return _mm512_cvtepu16_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+        case 4:
+            return _mm512_cvtepu32_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+        }
+        return _mm512_loadu_si512(src);
+    }
+
+    //! Decode the block of width N, `tail` holds the tail bits of every value
+    template<int N>
+    BITPACK_AVX512 static void _read(const u8* in, const u8* tail, u64* output) {
+        typedef BlockKernel<N> K;
+        for (int i = 0; i < 16; i += 8) {
+            __m512i value = _mm512_setzero_si512();
+            if (N == 64) {
+                value = _unpack8<u64>(in, i);
+            }
+            if (K::HAS32 != 0) {
+                value = _unpack8<u32>(in, i);
+            }
+            if (K::HAS16 != 0) {
+                value = _mm512_or_si512(value, _mm512_slli_epi64(_unpack8<u16>(in + K::OFFSET16, i), K::SHIFT16));
+            }
+            if (K::HAS8 != 0) {
+                value = _mm512_or_si512(value, _mm512_slli_epi64(_unpack8<u8>(in + K::OFFSET8, i), K::SHIFT8));
+            }
+            if (K::TAIL != 0) {
+                value = _mm512_or_si512(value, _mm512_slli_epi64(_unpack8<u8>(tail, i), K::SHIFT_TAIL));
+            }
+            _mm512_storeu_si512(output + i, value);
+        }
+    }
+
+    BITPACK_AVX512 static void _pack1(const u64* input, u8* out, int shift) {
+        const __m512i bit = _mm512_set1_epi64(static_cast<i64>(1ull << shift));
+        const u16 lo = _mm512_test_epi64_mask(_mm512_loadu_si512(input), bit);
+        const u16 hi = _mm512_test_epi64_mask(_mm512_loadu_si512(input + 8), bit);
+        const u16 bits = static_cast<u16>(lo | (hi << 8));
+        std::memcpy(out, &bits, sizeof(bits));
+    }
+
+    template<int R>
+    BITPACK_AVX512 static void _packTail(const u64* input, u8* out, int shift) {
+        if (R == 1) {
+            _pack1(input, out, shift);
+            return;
+        }
+        ScalarKernels::_packTail<R>(input, out, shift);
+    }
+};
@@ -0,0 +1,157 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "stream.h"
+
+/** Output sinks for BasicEncoder. `allocate(size)` returns `size` bytes
+  * of contiguous memory for one encoded block (nullptr if the sink is
+  * full), `size()` is the number of bytes written. MemoryStream is a
+  * sink as well.
+  */
+
+//! Owns its buffer and grows it geometrically, never runs out of space
+class GrowableSink {
+    std::vector<u8> data_;
+    size_t size_;
+public:
+    explicit GrowableSink(size_t capacity = 0x1000)
+        : data_(std::max<size_t>(capacity, 1))
+        , size_(0)
+    {
+    }
+
+    //! Pointers returned earlier are invalidated when the buffer grows
+    u8* allocate(size_t size) {
+        if (data_.size() - size_ < size) {
+            data_.resize(std::max(2*data_.size(), size_ + size));
+        }
+        u8* out = data_.data() + size_;
+        size_ += size;
+        return out;
+    }
+
+    const u8* data() const {
+        return data_.data();
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    size_t capacity() const {
+        return data_.size();
+    }
+
+    void reset() {
+        size_ = 0;
+    }
+};
+
+//! Writes straight into a buffer owned by the caller
+class BufferSink {
+    u8* begin_;
+    u8* pos_;
+    u8* end_;
+public:
+    BufferSink(u8* data, size_t size)
+        : begin_(data)
+        , pos_(data)
+        , end_(data + size)
+    {
+    }
+
+    u8* allocate(size_t size) {
+        if (static_cast<size_t>(end_ - pos_) < size) {
+            return nullptr;
+        }
+        u8* out = pos_;
+        pos_ += size;
+        return out;
+    }
+
+    const u8* data() const {
+        return begin_;
+    }
+
+    size_t size() const {
+        return static_cast<size_t>(pos_ - begin_);
+    }
+
+    void reset() {
+        pos_ = begin_;
+    }
+};
+
+/** Chain of fixed-size segments, a new one is started when the block
+  * doesn't fit into the last segment. Bytes already written are never
+  * moved and blocks never straddle segments, so every segment can be
+  * decoded on its own.
+  */
+class SegmentedSink {
+    struct Segment {
+        std::unique_ptr<u8[]> data;
+        size_t size;
+        size_t capacity;
+    };
+
+    std::vector<Segment> segments_;
+    size_t segment_size_;
+    size_t size_;
+public:
+    explicit SegmentedSink(size_t segment_size = 0x10000)
+        : segment_size_(segment_size)
+        , size_(0)
+    {
+        if (segment_size == 0) {
+            throw std::invalid_argument("Segment size should be positive");
+        }
+    }
+
+    u8* allocate(size_t size) {
+        if (segments_.empty() || segments_.back().capacity - segments_.back().size < size) {
+            Segment segment;
+            segment.capacity = std::max(segment_size_, size);
+            segment.data.reset(new u8[segment.capacity]);
+            segment.size = 0;
+            segments_.push_back(std::move(segment));
+        }
+        Segment& last = segments_.back();
+        u8* out = last.data.get() + last.size;
+        last.size += size;
+        size_ += size;
+        return out;
+    }
+
+    //! Total number of bytes written
+    size_t size() const {
+        return size_;
+    }
+
+    size_t nsegments() const {
+        return segments_.size();
+    }
+
+    const u8* segment_data(size_t i) const {
+        return segments_[i].data.get();
+    }
+
+    //! Bytes written to segment `i`
+    size_t segment_size(size_t i) const {
+        return segments_[i].size;
+    }
+
+    //! Copy all segments one after another, `output` should hold `size()` bytes
+    void copy_to(u8* output) const {
+        for (size_t i = 0; i < segments_.size(); i++) {
+            output = std::copy(segments_[i].data.get(), segments_[i].data.get() + segments_[i].size, output);
+        }
+    }
+
+    void reset() {
+        segments_.clear();
+        size_ = 0;
+    }
+};
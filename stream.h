@@ -0,0 +1,139 @@
+#pragma once
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+typedef std::uint64_t u64;
+typedef std::int64_t  i64;
+typedef std::uint32_t u32;
+typedef std::int32_t  i32;
+typedef std::uint16_t u16;
+typedef std::int16_t  i16;
+typedef unsigned char  u8;
+
+//! Result of the exception-free decode API
+enum Status {
+    STATUS_OK,
+    //! Stream is shorter than the encoded block
+    STATUS_END_OF_STREAM,
+    STATUS_INVALID_WIDTH,
+};
+
+class MemoryStream {
+    std::vector<u8> data_;
+    u8* pos_;
+    u8* end_;
+public:
+
+    MemoryStream(size_t size)
+        : data_(size)
+        , pos_(data_.data())
+        , end_(data_.data() + size)
+    {
+    }
+
+    template <class TVal> bool put_raw(TVal value) {
+        u8* out = allocate(sizeof(value));
+        if (!out) {
+            return false;
+        }
+        std::memcpy(out, &value, sizeof(value));
+        return true;
+    }
+
+    template <class TVal> TVal read_raw() {
+        TVal out;
+        std::memcpy(&out, consume(sizeof(out)), sizeof(out));
+        return out;
+    }
+
+    //! Reserve `size` bytes for writing, returns nullptr if the stream is full
+    u8* allocate(size_t size) {
+        if (static_cast<size_t>(end_ - pos_) < size) {
+            return nullptr;
+        }
+        u8* out = pos_;
+        pos_ += size;
+        return out;
+    }
+
+    //! Consume `size` bytes for reading
+    const u8* consume(size_t size) {
+        const u8* out = try_consume(size);
+        if (!out) {
+            throw std::out_of_range("End-Of-Stream");
+        }
+        return out;
+    }
+
+    //! Consume `size` bytes for reading, returns nullptr if the stream is too short
+    const u8* try_consume(size_t size) {
+        if (static_cast<size_t>(end_ - pos_) < size) {
+            return nullptr;
+        }
+        const u8* out = pos_;
+        pos_ += size;
+        return out;
+    }
+
+    const u8* data() const {
+        return data_.data();
+    }
+
+    //! Number of bytes written (or read) since last reset
+    size_t size() const {
+        return static_cast<size_t>(pos_ - data_.data());
+    }
+
+    void reset() {
+        pos_ = data_.data();
+    }
+};
+
+//! Reads blocks from memory owned by the caller (sink contents, mapped files)
+class BufferSource {
+    const u8* begin_;
+    const u8* pos_;
+    const u8* end_;
+public:
+    BufferSource(const u8* data, size_t size)
+        : begin_(data)
+        , pos_(data)
+        , end_(data + size)
+    {
+    }
+
+    //! Consume `size` bytes for reading
+    const u8* consume(size_t size) {
+        const u8* out = try_consume(size);
+        if (!out) {
+            throw std::out_of_range("End-Of-Stream");
+        }
+        return out;
+    }
+
+    //! Consume `size` bytes for reading, returns nullptr if the buffer is too short
+    const u8* try_consume(size_t size) {
+        if (static_cast<size_t>(end_ - pos_) < size) {
+            return nullptr;
+        }
+        const u8* out = pos_;
+        pos_ += size;
+        return out;
+    }
+
+    const u8* data() const {
+        return begin_;
+    }
+
+    //! Number of bytes read since last reset
+    size_t size() const {
+        return static_cast<size_t>(pos_ - begin_);
+    }
+
+    void reset() {
+        pos_ = begin_;
+    }
+};
@@ -0,0 +1,73 @@
+#pragma once
+#include "scalar.h"
+
+/** Pack and unpack kernels for narrow integer arrays (u8, u16, u32, i32,
+  * i64, ...). Stream layout is the same as for u64, the fused kernel of
+  * every (width, type) pair converts the values in registers. Widths above
+  * the size of the type are not available.
+  */
+namespace typed {
+
+//! Policy of BlockKernel::decode, stores values converted to `T`
+template<typename T>
+struct StoreAs {
+    T* output;
+
+    void operator () (int i, u64 value) {
+        output[i] = static_cast<T>(value);
+    }
+};
+
+template<typename T>
+struct Table {
+    //! Encode/decode one block in place, `2*N` bytes
+    typedef void (*WriteFn)(const T* input, u8* output);
+    typedef void (*ReadFn)(const u8* input, T* output);
+
+    enum {
+        MAX_WIDTH = 8*sizeof(T),
+    };
+
+    //! Entries above MAX_WIDTH are null
+    WriteFn write[65];
+    ReadFn read[65];
+};
+
+template<typename T, int N>
+struct Kernel {
+    static void read(const u8* input, T* output) {
+        StoreAs<T> op = { output };
+        BlockKernel<N>::decode(input, op);
+    }
+};
+
+template<typename T, int N>
+struct Fill {
+    static void run(Table<T>& table) {
+        table.write[N] = &BlockKernel<N>::write;
+        table.read[N] = &Kernel<T, N>::read;
+        Fill<T, N - 1>::run(table);
+    }
+};
+
+template<typename T>
+struct Fill<T, -1> {
+    static void run(Table<T>&) {
+    }
+};
+
+template<typename T>
+Table<T> make_table() {
+    Table<T> table = {};
+    Fill<T, Table<T>::MAX_WIDTH>::run(table);
+    return table;
+}
+
+//! Kernels for widths 0 to 8*sizeof(T)
+template<typename T>
+const Table<T>& table() {
+    static const Table<T> instance = make_table<T>();
+    return instance;
+}
+
+}  // namespace typed
@@ -0,0 +1,329 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
+#include "bitpack.h"
+#include "cpu.h"
+
+/** Vertical (lane interleaved) layout.
+  * Block contains 32*LANES values, value `i` goes to lane `i % LANES`.
+  * Each lane packs its 32 values LSB-first into 64-bit words, word `k`
+  * of lane `l` is stored at u64 offset `k*LANES + l`. For odd widths
+  * the last half-word of every lane is stored after the full words
+  * as one u32 per lane. Block of width `n` takes exactly 4*LANES*n bytes.
+  */
+namespace vertical {
+
+template<int N, int LANES>
+struct Scalar {
+    static u64 load(const u8* input, int k, int l) {
+        if (k < N/2) {
+            u64 word;
+            std::memcpy(&word, input + 8*(k*LANES + l), sizeof(word));
+            return word;
+        }
+        u32 half;
+        std::memcpy(&half, input + 8*LANES*(N/2) + 4*l, sizeof(half));
+        return half;
+    }
+
+    static void pack(const u64* input, u8* output) {
+        for (int l = 0; l < LANES; l++) {
+            u64 acc = 0;
+            int k = 0;
+            for (int j = 0; j < 32; j++) {
+                const u64 value = input[j*LANES + l] & Mask<N>::value;
+                const int shift = (j*N) % 64;
+                acc |= value << shift;
+                if (shift + N >= 64) {
+                    std::memcpy(output + 8*(k*LANES + l), &acc, sizeof(acc));
+                    k++;
+                    acc = shift ? value >> ((64 - shift) & 63) : 0;
+                }
+            }
+            if (N % 2) {
+                const u32 half = static_cast<u32>(acc);
+                std::memcpy(output + 8*LANES*(N/2) + 4*l, &half, sizeof(half));
+            }
+        }
+    }
+
+    static void unpack(const u8* input, u64* output) {
+        if (N == 0) {
+            std::fill(output, output + 32*LANES, 0ull);
+            return;
+        }
+        for (int l = 0; l < LANES; l++) {
+            u64 cur = load(input, 0, l);
+            int ck = 0;
+            for (int j = 0; j < 32; j++) {
+                const int k = (j*N) / 64;
+                const int shift = (j*N) % 64;
+                if (k != ck) {
+                    cur = load(input, k, l);
+                    ck = k;
+                }
+                u64 value = cur >> shift;
+                if (shift + N > 64) {
+                    cur = load(input, k + 1, l);
+                    ck = k + 1;
+                    value |= cur << ((64 - shift) & 63);
+                }
+                output[j*LANES + l] = value & Mask<N>::value;
+            }
+        }
+    }
+};
+
+//! Processes four lanes per ymm register, LANES should be a multiple of 4
+template<int N, int LANES>
+struct Avx2 {
+    BITPACK_AVX2 static void pack(const u64* input, u8* output) {
+        const __m256i mask = _mm256_set1_epi64x(static_cast<i64>(Mask<N>::value));
+        for (int g = 0; g < LANES; g += 4) {
+            __m256i acc = _mm256_setzero_si256();
+            int k = 0;
+#pragma GCC unroll 32
+            for (int j = 0; j < 32; j++) {
+                const __m256i value = _mm256_and_si256(
+                            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + j*LANES + g)), mask);
+                const int shift = (j*N) % 64;
+                acc = _mm256_or_si256(acc, _mm256_slli_epi64(value, shift));
+                if (shift + N >= 64) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + 8*(k*LANES + g)), acc);
+                    k++;
+                    acc = _mm256_srli_epi64(value, 64 - shift);
+                }
+            }
+            if (N % 2) {
+                const __m256i idx = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+                const __m256i half = _mm256_permutevar8x32_epi32(acc, idx);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 8*LANES*(N/2) + 4*g),
+                                 _mm256_castsi256_si128(half));
+            }
+        }
+    }
+
+    BITPACK_AVX2 static void unpack(const u8* input, u64* output) {
+        if (N == 0) {
+            std::fill(output, output + 32*LANES, 0ull);
+            return;
+        }
+        const __m256i mask = _mm256_set1_epi64x(static_cast<i64>(Mask<N>::value));
+        for (int g = 0; g < LANES; g += 4) {
+            const u8* words = input + 8*g;
+            const u8* tail = input + 8*LANES*(N/2) + 4*g;
+            __m256i cur = N/2 > 0
+                        ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words))
+                        : _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)));
+            int ck = 0;
+#pragma GCC unroll 32
+            for (int j = 0; j < 32; j++) {
+                const int k = (j*N) / 64;
+                const int shift = (j*N) % 64;
+                if (k != ck) {
+                    cur = k < N/2
+                        ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + 8*k*LANES))
+                        : _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)));
+                    ck = k;
+                }
+                __m256i value = _mm256_srli_epi64(cur, shift);
+                if (shift + N > 64) {
+                    cur = k + 1 < N/2
+                        ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + 8*(k + 1)*LANES))
+                        : _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)));
+                    ck = k + 1;
+                    value = _mm256_or_si256(value, _mm256_slli_epi64(cur, 64 - shift));
+                }
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + j*LANES + g),
+                                    _mm256_and_si256(value, mask));
+            }
+        }
+    }
+};
+
+//! Processes eight lanes per zmm register, LANES should be a multiple of 8
+template<int N, int LANES>
+struct Avx512 {
+    BITPACK_AVX512 static void pack(const u64* input, u8* output) {
+        const __m512i mask = _mm512_set1_epi64(static_cast<i64>(Mask<N>::value));
+        for (int g = 0; g < LANES; g += 8) {
+            __m512i acc = _mm512_setzero_si512();
+            int k = 0;
+#pragma GCC unroll 32
+            for (int j = 0; j < 32; j++) {
+                const __m512i value = _mm512_and_si512(_mm512_loadu_si512(input + j*LANES + g), mask);
+                const int shift = (j*N) % 64;
+                acc = _mm512_or_si512(acc, _mm512_slli_epi64(value, shift));
+                if (shift + N >= 64) {
+                    _mm512_storeu_si512(output + 8*(k*LANES + g), acc);
+                    k++;
+                    acc = _mm512_srli_epi64(value, 64 - shift);
+                }
+            }
+            if (N % 2) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + 8*LANES*(N/2) + 4*g),
+                                    _mm512_cvtepi64_epi32(acc));
+            }
+        }
+    }
+
+    BITPACK_AVX512 static void unpack(const u8* input, u64* output) {
+        if (N == 0) {
+            std::fill(output, output + 32*LANES, 0ull);
+            return;
+        }
+        const __m512i mask = _mm512_set1_epi64(static_cast<i64>(Mask<N>::value));
+        for (int g = 0; g < LANES; g += 8) {
+            const u8* words = input + 8*g;
+            const u8* tail = input + 8*LANES*(N/2) + 4*g;
+            __m512i cur = N/2 > 0
+                        ? _mm512_loadu_si512(words)
+                        : _mm512_cvtepu32_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail)));
+            int ck = 0;
+#pragma GCC unroll 32
+            for (int j = 0; j < 32; j++) {
+                const int k = (j*N) / 64;
+                const int shift = (j*N) % 64;
+                if (k != ck) {
+                    cur = k < N/2
+                        ? _mm512_loadu_si512(words + 8*k*LANES)
+                        : _mm512_cvtepu32_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail)));
+                    ck = k;
+                }
+                __m512i value = _mm512_srli_epi64(cur, shift);
+                if (shift + N > 64) {
+                    cur = k + 1 < N/2
+                        ? _mm512_loadu_si512(words + 8*(k + 1)*LANES)
+                        : _mm512_cvtepu32_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail)));
+                    ck = k + 1;
+                    value = _mm512_or_si512(value, _mm512_slli_epi64(cur, 64 - shift));
+                }
+                _mm512_storeu_si512(output + j*LANES + g, _mm512_and_si512(value, mask));
+            }
+        }
+    }
+};
+
+template<int LANES>
+struct Kernels {
+    typedef void (*PackFn)(const u64* input, u8* output);
+    typedef void (*UnpackFn)(const u8* input, u64* output);
+
+    const char* name;
+    PackFn pack[65];
+    UnpackFn unpack[65];
+};
+
+template<template<int, int> class Impl, int LANES, int N>
+struct Fill {
+    static void run(Kernels<LANES>& table) {
+        table.pack[N] = &Impl<N, LANES>::pack;
+        table.unpack[N] = &Impl<N, LANES>::unpack;
+        Fill<Impl, LANES, N - 1>::run(table);
+    }
+};
+
+template<template<int, int> class Impl, int LANES>
+struct Fill<Impl, LANES, -1> {
+    static void run(Kernels<LANES>&) {
+    }
+};
+
+template<template<int, int> class Impl, int LANES>
+Kernels<LANES> make_kernels(const char* name) {
+    Kernels<LANES> table;
+    table.name = name;
+    Fill<Impl, LANES, 64>::run(table);
+    return table;
+}
+
+template<int LANES>
+const Kernels<LANES>& scalar_kernels() {
+    static const Kernels<LANES> table = make_kernels<Scalar, LANES>("scalar");
+    return table;
+}
+
+template<int LANES>
+const Kernels<LANES>& avx2_kernels() {
+    static const Kernels<LANES> table = make_kernels<Avx2, LANES>("avx2");
+    return table;
+}
+
+//! AVX-512 kernels are only defined for 8-lane blocks
+inline const Kernels<8>& avx512_kernels() {
+    static const Kernels<8> table = make_kernels<Avx512, 8>("avx512");
+    return table;
+}
+
+template<int LANES>
+const Kernels<LANES>& best_kernels() {
+    if (cpu_features().avx2) {
+        return avx2_kernels<LANES>();
+    }
+    return scalar_kernels<LANES>();
+}
+
+template<>
+inline const Kernels<8>& best_kernels<8>() {
+    if (cpu_features().avx512f) {
+        return avx512_kernels();
+    }
+    if (cpu_features().avx2) {
+        return avx2_kernels<8>();
+    }
+    return scalar_kernels<8>();
+}
+
+}  // namespace vertical
+
+/** Encoder for the vertical layout. Works with blocks of 128 (LANES = 4)
+  * or 256 (LANES = 8) values.
+  */
+template<int LANES>
+class VerticalEncoder {
+    MemoryStream &stream_;
+    const vertical::Kernels<LANES>& kernels_;
+public:
+    enum {
+        BLOCK_SIZE = 32*LANES,
+    };
+
+    VerticalEncoder(MemoryStream& stream,
+                    const vertical::Kernels<LANES>& kernels = vertical::best_kernels<LANES>())
+        : stream_(stream)
+        , kernels_(kernels)
+    {
+    }
+
+    static size_t block_bytes(int n) {
+        return static_cast<size_t>(4*LANES*n);
+    }
+
+    //! Pack a block of width `n`, returns false if the width is invalid or the stream is full
+    bool pack(const u64* input, int n) {
+        if (n < 0 || n > 64) {
+            return false;
+        }
+        u8* out = stream_.allocate(block_bytes(n));
+        if (!out) {
+            return false;
+        }
+        kernels_.pack[n](input, out);
+        return true;
+    }
+
+    //! Unpack a block of width `n`, output is overwritten. Doesn't throw.
+    Status unpack(u64* output, int n) {
+        if (n < 0 || n > 64) {
+            return STATUS_INVALID_WIDTH;
+        }
+        const u8* in = stream_.try_consume(block_bytes(n));
+        if (!in) {
+            return STATUS_END_OF_STREAM;
+        }
+        kernels_.unpack[n](in, output);
+        return STATUS_OK;
+    }
+};
@@ -0,0 +1,266 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "stream.h"
+
+/** Seeded workload generators for tests and benchmarks. Every generator
+  * produces the same sequence for the same seed on every platform, except
+  * Zipf, whose sequence also depends on the libm (see below).
+  */
+namespace workload {
+
+//! xoshiro256** seeded with splitmix64
+class Rng {
+    u64 state_[4];
+
+    static u64 _rotate(u64 x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+public:
+    explicit Rng(u64 seed) {
+        for (int i = 0; i < 4; i++) {
+            seed += 0x9E3779B97F4A7C15ull;
+            u64 z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            state_[i] = z ^ (z >> 31);
+        }
+    }
+
+    u64 next() {
+        const u64 result = _rotate(state_[1] * 5, 7) * 9;
+        const u64 t = state_[1] << 17;
+        state_[2] ^= state_[0];
+        state_[3] ^= state_[1];
+        state_[1] ^= state_[2];
+        state_[0] ^= state_[3];
+        state_[2] ^= t;
+        state_[3] = _rotate(state_[3], 45);
+        return result;
+    }
+
+    //! Uniform in [0, bound), bound > 0
+    u64 below(u64 bound) {
+        return static_cast<u64>((static_cast<unsigned __int128>(next()) * bound) >> 64);
+    }
+
+    //! Uniform in [0, 1)
+    double uniform() {
+        return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+enum {
+    DEFAULT_SEED = 0x5EED,
+};
+
+//! Uniform values masked by `mask`, worst case for every codec
+class Uniform {
+    Rng rng_;
+    u64 mask_;
+public:
+    explicit Uniform(u64 mask, u64 seed = DEFAULT_SEED)
+        : rng_(seed)
+        , mask_(mask)
+    {
+    }
+
+    u64 generate() {
+        return rng_.next() & mask_;
+    }
+};
+
+//! Steps uniform in [-max_step, max_step] from `start`, wraps around
+class RandomWalk {
+    Rng rng_;
+    u64 value_;
+    u64 max_step_;
+public:
+    RandomWalk(u64 start, u64 max_step, u64 seed = DEFAULT_SEED)
+        : rng_(seed)
+        , value_(start)
+        , max_step_(max_step)
+    {
+    }
+
+    u64 generate() {
+        value_ += rng_.below(2*max_step_ + 1) - max_step_;
+        return value_;
+    }
+};
+
+//! Monotonic timestamps `interval` apart with jitter in [-jitter, jitter], jitter < interval
+class Timestamps {
+    Rng rng_;
+    u64 value_;
+    u64 interval_;
+    u64 jitter_;
+public:
+    Timestamps(u64 start, u64 interval, u64 jitter, u64 seed = DEFAULT_SEED)
+        : rng_(seed)
+        , value_(start)
+        , interval_(interval)
+        , jitter_(jitter)
+    {
+    }
+
+    u64 generate() {
+        value_ += interval_ + rng_.below(2*jitter_ + 1) - jitter_;
+        return value_;
+    }
+};
+
+/** Ids in [0, n), id `k` has probability proportional to 1/(k + 1)^s.
+  * The CDF is built with std::pow, which isn't correctly rounded, so the
+  * sequence is the same for a given seed and libm only.
+  */
+class Zipf {
+    Rng rng_;
+    std::vector<double> cdf_;
+public:
+    Zipf(u64 n, double s, u64 seed = DEFAULT_SEED)
+        : rng_(seed)
+        , cdf_(std::max<u64>(n, 1))
+    {
+        double sum = 0;
+        for (size_t k = 0; k < cdf_.size(); k++) {
+            sum += 1.0 / std::pow(static_cast<double>(k + 1), s);
+            cdf_[k] = sum;
+        }
+        for (size_t k = 0; k < cdf_.size(); k++) {
+            cdf_[k] /= sum;
+        }
+    }
+
+    u64 generate() {
+        const double u = rng_.uniform();
+        const size_t k = std::upper_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+        return std::min(k, cdf_.size() - 1);
+    }
+};
+
+/** Mostly zero samples, `density` of them are small counts in
+  * [1, max_count], `outlier_rate` are large values of `outlier_bits` bits.
+  */
+class SparseCounters {
+    Rng rng_;
+    double density_;
+    u64 max_count_;
+    double outlier_rate_;
+    int outlier_bits_;
+public:
+    SparseCounters(double density, u64 max_count, double outlier_rate, int outlier_bits,
+                   u64 seed = DEFAULT_SEED)
+        : rng_(seed)
+        , density_(density)
+        , max_count_(max_count)
+        , outlier_rate_(outlier_rate)
+        , outlier_bits_(outlier_bits)
+    {
+    }
+
+    u64 generate() {
+        const double u = rng_.uniform();
+        if (u < outlier_rate_) {
+            const u64 top = 1ull << (outlier_bits_ - 1);
+            return top | (rng_.next() & (top - 1));
+        }
+        if (u < outlier_rate_ + density_) {
+            return 1 + rng_.below(max_count_);
+        }
+        return 0;
+    }
+};
+
+//! Ascending runs of `run_length` values, steps in [0, max_step], every run starts anew below `max_start`
+class SortedRuns {
+    Rng rng_;
+    u64 value_;
+    u64 run_length_;
+    u64 max_step_;
+    u64 max_start_;
+    u64 index_;
+public:
+    SortedRuns(u64 run_length, u64 max_step, u64 max_start, u64 seed = DEFAULT_SEED)
+        : rng_(seed)
+        , value_(0)
+        , run_length_(run_length)
+        , max_step_(max_step)
+        , max_start_(max_start)
+        , index_(0)
+    {
+    }
+
+    u64 generate() {
+        if (index_++ % run_length_ == 0) {
+            value_ = rng_.below(max_start_);
+        } else {
+            value_ += rng_.below(max_step_ + 1);
+        }
+        return value_;
+    }
+};
+
+//! `n` values from the generator
+template<class Generator>
+std::vector<u64> generate(Generator& gen, size_t n) {
+    std::vector<u64> values(n);
+    for (size_t i = 0; i < n; i++) {
+        values[i] = gen.generate();
+    }
+    return values;
+}
+
+//! Named distributions used by the benchmarks
+enum Distribution {
+    UNIFORM_32,
+    RANDOM_WALK,
+    TIMESTAMPS,
+    ZIPF,
+    SPARSE_COUNTERS,
+    SORTED_RUNS,
+    DISTRIBUTION_COUNT,
+};
+
+inline const char* distribution_name(Distribution d) {
+    static const char* names[] = {
+        "uniform32", "random_walk", "timestamps", "zipf", "sparse_counters", "sorted_runs",
+    };
+    return names[d];
+}
+
+inline std::vector<u64> generate(Distribution d, size_t n, u64 seed = DEFAULT_SEED) {
+    switch (d) {
+    case UNIFORM_32: {
+        Uniform gen(0xFFFFFFFFull, seed);
+        return generate(gen, n);
+    }
+    case RANDOM_WALK: {
+        RandomWalk gen(1ull << 40, 1000, seed);
+        return generate(gen, n);
+    }
+    case TIMESTAMPS: {
+        Timestamps gen(1500000000000ull, 1000, 10, seed);
+        return generate(gen, n);
+    }
+    case ZIPF: {
+        Zipf gen(100000, 1.1, seed);
+        return generate(gen, n);
+    }
+    case SPARSE_COUNTERS: {
+        SparseCounters gen(0.2, 100, 0.002, 40, seed);
+        return generate(gen, n);
+    }
+    case SORTED_RUNS: {
+        SortedRuns gen(1000, 16, 1ull << 32, seed);
+        return generate(gen, n);
+    }
+    default:
+        break;
+    }
+    return std::vector<u64>();
+}
+
+}  // namespace workload